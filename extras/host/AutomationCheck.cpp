@@ -0,0 +1,194 @@
+// Checks Process with an AutomationTimeline against doing the same by hand: the block split at every event
+// and SetParameter called between the pieces. Both have to match to the bit, for the float and the Q31
+// engine, with the ring and the FDN tank, at sample resolution and with events grouped at a coarser one.
+//
+// Needs the Polygons library sources built for the host, e.g.
+//   g++ -std=c++17 -O2 -DZ4_HOST -I<Polygons>/src -I../../src AutomationCheck.cpp -o automationcheck
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+#include "ControllerZ4.h"
+
+using namespace Z4;
+
+const int Blocks = 600;
+const int BurstBlocks = 100;
+const int Events = 400;
+
+// Decay, SizeEarly, SizeLate, Diffuse, LowCutPre, HighCutPre, Modulate, Mix,
+// EarlyStages, Interpolation, Shimmer, InputMode, LowCutPost, HighCutPost, InGain, OutGain, Active, Freeze
+const int Defaults[Parameter::COUNT] = {600, 512, 700, 512, 1023, 0, 300, 512, 512, 3, 0, 0, 1023, 0, 0, 512, 1, 0};
+
+// raw values that reach the top of each range, see ScaleParameter
+const int MaxValue[Parameter::COUNT] = {1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023, 8, 64, 8, 1023, 1023, 1023, 1023, 1, 1};
+
+uint32_t Seed = 1;
+
+uint32_t Random()
+{
+    Seed = Seed * 1664525u + 1013904223u;
+    return Seed >> 8;
+}
+
+void Noise(float* dest) { *dest = (Random() * (1.0f / 16777216.0f) - 0.5f) * 0.5f; }
+void Noise(int32_t* dest) { *dest = (int32_t)((Random() << 8) - 0x80000000u) >> 2; }
+
+void QuietSink(int, const char*) { }
+
+struct Event
+{
+    uint64_t Time;
+    int Param;
+    uint16_t Value;
+};
+
+template<typename TController>
+TController* Create(TankMode mode, const std::vector<Event>& events)
+{
+    auto controller = new TController(48000);
+    for (int i = 0; i < Parameter::COUNT; i++)
+        controller->SetParameter(i, Defaults[i]);
+    controller->SetTankMode(mode);
+    // the timeline only uses shimmer modes that were prepared, make sure both sides have them all
+    for (auto& e : events)
+        if (e.Param == Parameter::Shimmer)
+            controller->SetParameter(e.Param, e.Value);
+    for (auto& e : events)
+        if (e.Param == Parameter::Shimmer)
+            controller->SetParameter(Parameter::Shimmer, Defaults[Parameter::Shimmer]);
+    Log::Drain();
+    return controller;
+}
+
+// Renders the input either through the timeline, or by hand, grouping events the way the timeline
+// documents it: everything within resolution samples of a split is applied at the split
+template<typename TController>
+std::vector<typename TController::Sample> Render(TankMode mode, const std::vector<Event>& events, int resolution, bool manual)
+{
+    typedef typename TController::Sample Sample;
+    static AutomationTimeline<Events> timeline;
+    auto controller = Create<TController>(mode, events);
+    timeline.Clear();
+    timeline.Resolution = resolution;
+    for (auto& e : events)
+        timeline.Add(e.Time, e.Param, e.Value);
+
+    Sample inL[BUFFER_SIZE], inR[BUFFER_SIZE], outL[BUFFER_SIZE], outR[BUFFER_SIZE];
+    Sample* ins[2] = {inL, inR};
+    Sample* outs[2] = {outL, outR};
+    std::vector<Sample> result;
+    size_t next = 0;
+    Seed = 1;
+
+    for (int b = 0; b < Blocks; b++)
+    {
+        for (int i = 0; i < BUFFER_SIZE; i++)
+        {
+            if (b < BurstBlocks)
+            {
+                Noise(&inL[i]);
+                Noise(&inR[i]);
+            }
+            else
+                inL[i] = inR[i] = 0;
+        }
+
+        uint64_t blockStart = (uint64_t)b * BUFFER_SIZE;
+        if (!manual)
+            controller->Process(ins, outs, BUFFER_SIZE, timeline);
+        else
+        {
+            int start = 0;
+            while (start < BUFFER_SIZE)
+            {
+                while (next < events.size() && events[next].Time < blockStart + start + resolution)
+                {
+                    controller->SetParameter(events[next].Param, events[next].Value);
+                    next++;
+                }
+
+                int end = BUFFER_SIZE;
+                if (next < events.size() && events[next].Time < blockStart + BUFFER_SIZE)
+                    end = (int)(events[next].Time - blockStart);
+
+                Sample* pieceIns[2] = {inL + start, inR + start};
+                Sample* pieceOuts[2] = {outL + start, outR + start};
+                controller->Process(pieceIns, pieceOuts, end - start);
+                start = end;
+            }
+        }
+
+        for (int i = 0; i < BUFFER_SIZE; i++)
+        {
+            result.push_back(outL[i]);
+            result.push_back(outR[i]);
+        }
+    }
+
+    delete controller;
+    Log::Drain();
+    return result;
+}
+
+template<typename TSample>
+bool Report(const char* label, const std::vector<TSample>& a, const std::vector<TSample>& b)
+{
+    size_t first = 0;
+    while (first < a.size() && memcmp(&a[first], &b[first], sizeof(TSample)) == 0)
+        first++;
+    if (first == a.size())
+    {
+        printf("%-48s ok\n", label);
+        return true;
+    }
+    printf("%-48s differs from sample %d\n", label, (int)(first / 2));
+    return false;
+}
+
+template<typename TController>
+int Check(const char* engine, TankMode mode)
+{
+    const char* tank = mode == TankMode::Fdn ? "fdn" : "ring";
+    char label[128];
+    int failed = 0;
+
+    // random changes of every parameter, sorted by time, a few of them landing on the same sample
+    std::vector<Event> events;
+    Seed = 12345;
+    for (int i = 0; i < Events; i++)
+    {
+        int param = Random() % Parameter::COUNT;
+        if (param == Parameter::Active)
+            continue;
+        uint64_t time = (i % 10 == 9 && !events.empty()) ? events.back().Time : Random() % (Blocks * BUFFER_SIZE);
+        events.push_back({time, param, (uint16_t)(Random() % (MaxValue[param] + 1))});
+    }
+    std::stable_sort(events.begin(), events.end(), [](const Event& a, const Event& b) { return a.Time < b.Time; });
+
+    for (int resolution : {1, 16, BUFFER_SIZE})
+    {
+        auto timeline = Render<TController>(mode, events, resolution, false);
+        auto manual = Render<TController>(mode, events, resolution, true);
+        snprintf(label, sizeof(label), "%s %s, resolution %d", engine, tank, resolution);
+        failed += !Report(label, timeline, manual);
+    }
+
+    return failed;
+}
+
+int main()
+{
+    // every shimmer and input mode change is logged, which would bury the results
+    Log::SetSink(QuietSink);
+
+    int failed = 0;
+    for (TankMode mode : {TankMode::Ring, TankMode::Fdn})
+    {
+        failed += Check<Controller>("float", mode);
+        failed += Check<ControllerFixed>("q31", mode);
+    }
+    printf("%d failed\n", failed);
+    return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,130 @@
+// Runs the float engine (Controller) and the Q31 engine (ControllerFixed) side by side on the same input
+// and reports how far apart they are: SNR of the fixed output against the float output, peak error,
+// and the idle noise the fixed engine leaves behind once the tail has decayed. Also times both engines,
+// on the host only, which says nothing about the Teensy.
+//
+// Needs the Polygons library sources built for the host, e.g.
+//   g++ -std=c++17 -O2 -DZ4_HOST -I<Polygons>/src -I../../src FixedCompare.cpp -o fixedcompare
+
+#include <stdlib.h>
+#include <chrono>
+#include "ControllerZ4.h"
+
+using namespace Z4;
+
+const int BurstBlocks = 100;    // ~0.27s of noise at 48kHz
+const int TotalBlocks = 2000;   // ~5.3s, the burst and its tail
+const int IdleBlocks = 100;     // the noise floor is measured over the last blocks
+
+struct Case
+{
+    const char* Name;
+    int Values[Parameter::COUNT];
+};
+
+uint32_t NoiseSeed = 1;
+
+int32_t Noise(float level)
+{
+    NoiseSeed = NoiseSeed * 1664525u + 1013904223u;
+    float value = ((NoiseSeed >> 8) * (1.0f / 16777216.0f) - 0.5f) * 2 * level;
+    return (int32_t)(value * 2147483647.0f);
+}
+
+double ToDb(double power)
+{
+    return 10 * log10(power > 1e-30 ? power : 1e-30);
+}
+
+void RunCase(const Case& c)
+{
+    Controller* floatEngine = new Controller(48000);
+    ControllerFixed* fixedEngine = new ControllerFixed(48000);
+    for (int i = 0; i < Parameter::COUNT; i++)
+    {
+        floatEngine->SetParameter(i, c.Values[i]);
+        fixedEngine->SetParameter(i, c.Values[i]);
+    }
+    Log::Drain();
+
+    int32_t inL[BUFFER_SIZE], inR[BUFFER_SIZE], outL[BUFFER_SIZE], outR[BUFFER_SIZE];
+    float inLf[BUFFER_SIZE], inRf[BUFFER_SIZE], outLf[BUFFER_SIZE], outRf[BUFFER_SIZE];
+    int32_t* ins[2] = {inL, inR};
+    int32_t* outs[2] = {outL, outR};
+    float* insF[2] = {inLf, inRf};
+    float* outsF[2] = {outLf, outRf};
+
+    double signal = 0, error = 0, peakError = 0, idleFixed = 0, idleFloat = 0;
+    double floatNanos = 0, fixedNanos = 0;
+    const float scale = 1.0f / 2147483648.0f;
+    NoiseSeed = 1;
+
+    for (int block = 0; block < TotalBlocks; block++)
+    {
+        for (int i = 0; i < BUFFER_SIZE; i++)
+        {
+            inL[i] = block < BurstBlocks ? Noise(0.25f) : 0; // -12dBFS peak
+            inR[i] = block < BurstBlocks ? Noise(0.25f) : 0;
+            inLf[i] = inL[i] * scale;
+            inRf[i] = inR[i] * scale;
+        }
+
+        auto t0 = std::chrono::steady_clock::now();
+        floatEngine->Process(insF, outsF, BUFFER_SIZE);
+        auto t1 = std::chrono::steady_clock::now();
+        fixedEngine->Process(ins, outs, BUFFER_SIZE);
+        auto t2 = std::chrono::steady_clock::now();
+        floatNanos += std::chrono::duration<double, std::nano>(t1 - t0).count();
+        fixedNanos += std::chrono::duration<double, std::nano>(t2 - t1).count();
+
+        for (int i = 0; i < BUFFER_SIZE; i++)
+        {
+            for (int ch = 0; ch < 2; ch++)
+            {
+                double ref = outsF[ch][i];
+                double out = outs[ch][i] * (double)scale;
+                double e = out - ref;
+                signal += ref * ref;
+                error += e * e;
+                if (fabs(e) > peakError)
+                    peakError = fabs(e);
+                if (block >= TotalBlocks - IdleBlocks)
+                {
+                    idleFixed += out * out;
+                    idleFloat += ref * ref;
+                }
+            }
+        }
+    }
+
+    int idleSamples = IdleBlocks * BUFFER_SIZE * 2;
+    printf("%-22s SNR %6.1f dB  peak err %7.1f dBFS  tail float %7.1f / fixed %7.1f dBFS rms  %5.2f / %5.2f us/block\n",
+        c.Name, ToDb(signal / error), 20 * log10(peakError > 1e-15 ? peakError : 1e-15),
+        ToDb(idleFloat / idleSamples), ToDb(idleFixed / idleSamples),
+        floatNanos / TotalBlocks / 1000, fixedNanos / TotalBlocks / 1000);
+
+    delete floatEngine;
+    delete fixedEngine;
+}
+
+int main()
+{
+    // Decay, SizeEarly, SizeLate, Diffuse, LowCutPre, HighCutPre, Modulate, Mix,
+    // EarlyStages, Interpolation, Shimmer, InputMode, LowCutPost, HighCutPost, InGain, OutGain, Active, Freeze
+    Case cases[] =
+    {
+        {"default",             {300, 512, 512, 512, 1023, 0, 300, 512,  512, 3, 0,  0, 1023, 0, 0, 512, 1, 0}},
+        {"short, dry",          {50,  200, 200, 300, 1023, 0, 100, 300,  300, 3, 0,  0, 1023, 0, 0, 512, 1, 0}},
+        {"long, dark",          {900, 900, 900, 800, 300, 100, 500, 1023, 1023, 3, 0, 0, 300, 100, 0, 512, 1, 0}},
+        {"quality low",         {300, 512, 512, 512, 1023, 0, 300, 512,  512, 0, 0,  0, 1023, 0, 0, 512, 1, 0}},
+        {"quality ultra",       {300, 512, 512, 512, 1023, 0, 300, 512,  512, 6, 0,  0, 1023, 0, 0, 512, 1, 0}},
+        {"dual mono",           {300, 512, 512, 512, 1023, 0, 300, 512,  512, 3, 0,  6, 1023, 0, 0, 512, 1, 0}},
+        {"true stereo",         {300, 512, 512, 512, 1023, 0, 300, 512,  512, 3, 0,  8, 1023, 0, 0, 512, 1, 0}},
+        {"shimmer fast up",     {600, 512, 512, 512, 1023, 0, 300, 512,  512, 3, 36, 0, 1023, 0, 0, 512, 1, 0}},
+        {"freeze",              {300, 512, 512, 512, 1023, 0, 300, 1023, 512, 3, 0,  0, 1023, 0, 0, 512, 1, 1}},
+    };
+
+    for (auto& c : cases)
+        RunCase(c);
+    return 0;
+}
@@ -0,0 +1,167 @@
+// Checks the deferred log (Log.h) through a capturing sink: how the stored arguments are formatted, that
+// levels and order come through Drain() unchanged, that a full ring drops and counts messages and reports
+// them once, and that nothing is lost or duplicated with two threads logging while the ring is drained.
+//
+// Needs the Polygons library sources built for the host, e.g.
+//   g++ -std=c++17 -O2 -pthread -DZ4_HOST -I<Polygons>/src -I../../src LogCheck.cpp -o logcheck
+
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Log.h"
+
+using namespace Z4;
+
+const int ThreadMessages = 20000;
+const int Burst = 8; // messages between yields, so the drain keeps up with most of them
+
+struct Line
+{
+    int Level;
+    std::string Text;
+};
+
+std::vector<Line> Captured;
+int Failed = 0;
+
+void CaptureSink(int level, const char* line)
+{
+    Captured.push_back({level, line});
+}
+
+void Expect(bool condition, const char* what)
+{
+    if (!condition)
+    {
+        printf("FAILED: %s\n", what);
+        Failed++;
+    }
+}
+
+void ExpectLine(size_t index, int level, const char* text)
+{
+    bool ok = index < Captured.size() && Captured[index].Level == level && Captured[index].Text == text;
+    if (!ok)
+    {
+        printf("FAILED: line %d is \"%s\" (%d), expected \"%s\" (%d)\n", (int)index,
+            index < Captured.size() ? Captured[index].Text.c_str() : "", index < Captured.size() ? Captured[index].Level : -1, text, level);
+        Failed++;
+    }
+}
+
+void CheckFormat()
+{
+    Captured.clear();
+    Z4_LOG_INFO("plain");
+    Z4_LOG_INFO("%d of %d", 3, 7.9);
+    Z4_LOG_INFO("%.2f%% at %5.1f", 12.345, 2.25);
+    Z4_LOG_WARN("%x %u", 255, 42.7);
+    Z4_LOG_ERROR("%d then %d", 1);
+    Z4_LOG_INFO("name %s", 1);
+    Z4_LOG_DEBUG("above the default level, compiled out");
+    Log::Drain();
+
+    Expect(Captured.size() == 6, "wrong number of lines");
+    ExpectLine(0, Z4_LOG_LEVEL_INFO, "plain");
+    ExpectLine(1, Z4_LOG_LEVEL_INFO, "3 of 7");
+    ExpectLine(2, Z4_LOG_LEVEL_INFO, "12.35% at   2.2");
+    ExpectLine(3, Z4_LOG_LEVEL_WARN, "ff 42");
+    ExpectLine(4, Z4_LOG_LEVEL_ERROR, "1 then 0"); // a missing argument is 0
+    ExpectLine(5, Z4_LOG_LEVEL_INFO, "name ?"); // strings can't be deferred
+
+    // lines longer than MaxLineLength are cut, not overrun
+    Captured.clear();
+    Z4_LOG_INFO("%0200d", 1);
+    Log::Drain();
+    Expect(Captured.size() == 1 && (int)Captured[0].Text.size() == Log::MaxLineLength - 1, "long line not cut at MaxLineLength");
+    printf("formatting checked\n");
+}
+
+void CheckDropped()
+{
+    Captured.clear();
+    uint32_t before = Log::GetDroppedCount();
+    for (int i = 0; i < Log::RingSize + 10; i++)
+        Z4_LOG_INFO("message %d", i);
+    Expect(Log::GetDroppedCount() - before == 10, "dropped messages not counted");
+
+    Log::Drain();
+    Expect((int)Captured.size() == Log::RingSize + 1, "full ring not drained");
+    char text[32];
+    for (int i = 0; i < Log::RingSize; i++)
+    {
+        snprintf(text, sizeof(text), "message %d", i);
+        ExpectLine(i, Z4_LOG_LEVEL_INFO, text);
+    }
+    ExpectLine(Log::RingSize, Z4_LOG_LEVEL_WARN, "Log: 10 messages dropped");
+
+    // reported once, and the ring is usable again
+    Captured.clear();
+    Z4_LOG_INFO("after");
+    Log::Drain();
+    Expect(Captured.size() == 1, "dropped messages reported twice");
+    ExpectLine(0, Z4_LOG_LEVEL_INFO, "after");
+    printf("dropped messages checked\n");
+}
+
+// Two producers, like the control thread and the audio interrupt, while this thread drains. Every
+// message either arrives once, in order for its producer, or is counted as dropped
+void CheckThreads()
+{
+    Captured.clear();
+    uint32_t before = Log::GetDroppedCount();
+    std::atomic<int> running(2);
+    auto produce = [&](int id)
+    {
+        for (int i = 0; i < ThreadMessages; i++)
+        {
+            Z4_LOG_INFO("%d %d", id, i);
+            if (i % Burst == Burst - 1)
+                std::this_thread::yield();
+        }
+        running--;
+    };
+
+    std::thread a(produce, 0);
+    std::thread b(produce, 1);
+    while (running > 0)
+    {
+        Log::Drain();
+        std::this_thread::yield();
+    }
+    a.join();
+    b.join();
+    Log::Drain();
+
+    int received[2] = {0, 0};
+    int last[2] = {-1, -1};
+    bool ordered = true;
+    for (auto& line : Captured)
+    {
+        int id, i;
+        if (line.Level != Z4_LOG_LEVEL_INFO || sscanf(line.Text.c_str(), "%d %d", &id, &i) != 2)
+            continue;
+        ordered = ordered && i > last[id];
+        last[id] = i;
+        received[id]++;
+    }
+    uint32_t dropped = Log::GetDroppedCount() - before;
+    Expect(ordered, "messages of one producer out of order or duplicated");
+    Expect(received[0] + received[1] + (int)dropped == 2 * ThreadMessages, "messages lost without being counted");
+    printf("two producers checked: %d received, %d dropped\n", received[0] + received[1], (int)dropped);
+}
+
+int main()
+{
+    Log::SetSink(CaptureSink);
+    CheckFormat();
+    CheckDropped();
+    CheckThreads();
+    Log::SetSink(Log::DefaultSink);
+
+    printf("%d failed\n", Failed);
+    return Failed == 0 ? 0 : 1;
+}
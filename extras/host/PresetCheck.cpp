@@ -0,0 +1,176 @@
+// Checks PresetStore against the host Storage: an old raw Z4/presets.bin is migrated to version 3 slot files
+// at first boot, stored presets come back after a reload, a copy with a bad CRC is skipped in favour of the
+// other one, and a slot with no valid copy falls back to the defaults.
+//
+// Run it in an empty directory, it writes Z4/presets.bin and the slot files there.
+//
+// Needs the Polygons library sources built for the host, e.g.
+//   g++ -std=c++17 -O2 -DZ4_HOST -I<Polygons>/src -I../../src PresetCheck.cpp -o presetcheck
+
+#include <stdio.h>
+#include <string.h>
+#include "ControllerZ4.h"
+#include "PresetStore.h"
+
+using namespace Z4;
+
+const int SlotCount = 7;
+const int LegacyParamCount = 18;
+const int SlotFileSize = 12 + Parameter::COUNT * 2 + 4; // header, values, CRC
+const int MaxUpdates = 100000;
+
+typedef PresetStore<SlotCount> Store;
+
+uint16_t Presets[SlotCount * Parameter::COUNT];
+int Failed = 0;
+
+void QuietSink(int, const char*) { }
+
+void Expect(bool condition, const char* what)
+{
+    if (!condition)
+    {
+        printf("FAILED: %s\n", what);
+        Failed++;
+    }
+}
+
+// Update() only writes once the debounce time has passed, then takes a few calls per slot
+Store::WriteResult WaitForWrite(Store& store)
+{
+    for (int i = 0; i < MaxUpdates; i++)
+    {
+        auto result = store.Update();
+        if (result != Store::WriteResult::None)
+            return result;
+    }
+    return Store::WriteResult::None;
+}
+
+void Reload()
+{
+    Store store;
+    store.LoadAll(Presets);
+}
+
+void FlipByte(const char* path, int offset)
+{
+    uint8_t data[SlotFileSize];
+    Storage::ReadFile(path, data, SlotFileSize);
+    data[offset] ^= 0x10;
+    Storage::WriteFile(path, data, SlotFileSize);
+}
+
+void CheckMigration(Controller* controller)
+{
+    // version 0: 18 raw values per slot, Input Mode on a 0-8 scale of three modes, Quality Low/High,
+    // and the five shimmer modes before the low latency ones were added
+    uint16_t legacy[SlotCount * LegacyParamCount];
+    for (int slot = 0; slot < SlotCount; slot++)
+    {
+        auto values = &legacy[slot * LegacyParamCount];
+        for (int i = 0; i < LegacyParamCount; i++)
+            values[i] = (uint16_t)(100 + slot * 10 + i);
+        values[Parameter::InputMode] = slot % 3 * 4;
+        values[Parameter::Interpolation] = slot % 2 == 0 ? 8 : 3;
+        values[Parameter::Shimmer] = (uint16_t)(slot * 64 / 6);
+    }
+    Storage::WriteFile("Z4/presets.bin", (uint8_t*)legacy, sizeof(legacy));
+
+    Store store;
+    store.LoadAll(Presets);
+
+    for (int slot = 0; slot < SlotCount; slot++)
+    {
+        auto values = &Presets[slot * Parameter::COUNT];
+        Expect(values[Parameter::Decay] == 100 + slot * 10, "legacy value not carried over");
+
+        // the modes have to mean the same after the migration as they did before it
+        int oldInput = (int)(legacy[slot * LegacyParamCount + Parameter::InputMode] / 8.0 * 2.999);
+        Expect((int)controller->ScaleParameter(Parameter::InputMode, values[Parameter::InputMode]) == oldInput, "input mode migrated wrong");
+        int quality = (int)controller->ScaleParameter(Parameter::Interpolation, values[Parameter::Interpolation]);
+        Expect(quality == (slot % 2 == 0 ? 1 : 0), "quality migrated wrong");
+        int oldShimmer = (int)(legacy[slot * LegacyParamCount + Parameter::Shimmer] / 64.0 * 5.999);
+        Expect((int)controller->ScaleParameter(Parameter::Shimmer, values[Parameter::Shimmer]) == oldShimmer, "shimmer mode migrated wrong");
+
+        char path[32];
+        uint8_t data[SlotFileSize];
+        sprintf(path, "Z4/preset%da.bin", slot);
+        Expect(Storage::FileExists(path) && Storage::ReadFile(path, data, SlotFileSize), "slot file not written at first boot");
+    }
+
+    // with slot files present presets.bin is no longer read
+    legacy[Parameter::Decay] = 999;
+    Storage::WriteFile("Z4/presets.bin", (uint8_t*)legacy, sizeof(legacy));
+    Reload();
+    Expect(Presets[Parameter::Decay] == 100, "presets.bin migrated a second time");
+    printf("migration from version 0 checked\n");
+}
+
+void CheckRoundTrip()
+{
+    Store store;
+    store.LoadAll(Presets);
+
+    // slot 2 is written to its b copy, then to its a copy
+    for (int pass = 0; pass < 2; pass++)
+    {
+        for (int i = 0; i < Parameter::COUNT; i++)
+            Presets[2 * Parameter::COUNT + i] = (uint16_t)(pass * 1000 + i);
+        store.Store(2, &Presets[2 * Parameter::COUNT]);
+        Expect(WaitForWrite(store) == Store::WriteResult::Ok, "stored slot not written");
+    }
+    Expect(store.Update() == Store::WriteResult::None, "slot written again without a Store");
+
+    Reload();
+    bool same = true;
+    for (int i = 0; i < Parameter::COUNT; i++)
+        same = same && Presets[2 * Parameter::COUNT + i] == 1000 + i;
+    Expect(same, "stored slot didn't load back");
+    Expect(Presets[Parameter::Decay] == 100, "other slots changed by a Store");
+    printf("round trip checked\n");
+}
+
+void CheckCrc()
+{
+    // the newest copy of slot 2 is a, flipping a value in it leaves b, the pass before
+    FlipByte("Z4/preset2a.bin", 20);
+    Reload();
+    Expect(Presets[2 * Parameter::COUNT + 3] == 3, "copy with a bad CRC wasn't skipped");
+
+    // a damaged header is skipped the same way
+    FlipByte("Z4/preset2b.bin", 0);
+    Reload();
+    bool defaults = true;
+    for (int i = 0; i < Parameter::COUNT; i++)
+        defaults = defaults && Presets[2 * Parameter::COUNT + i] == 0;
+    Expect(defaults, "slot without a valid copy didn't get the defaults");
+    Expect(Presets[3 * Parameter::COUNT + Parameter::Decay] == 130, "damaged slot affected another one");
+
+    // and the next write goes over a damaged copy, leaving a valid one
+    {
+        Store store;
+        store.LoadAll(Presets);
+        Presets[2 * Parameter::COUNT + 3] = 42;
+        store.Store(2, &Presets[2 * Parameter::COUNT]);
+        Expect(WaitForWrite(store) == Store::WriteResult::Ok, "slot with damaged copies not written");
+    }
+    Reload();
+    Expect(Presets[2 * Parameter::COUNT + 3] == 42, "slot with damaged copies didn't recover");
+    printf("CRC rejection checked\n");
+}
+
+int main()
+{
+    Log::SetSink(QuietSink);
+    Storage::CreateFolder("Z4");
+    auto controller = new Controller(48000);
+
+    CheckMigration(controller);
+    CheckRoundTrip();
+    CheckCrc();
+
+    delete controller;
+    printf("%d failed\n", Failed);
+    return Failed == 0 ? 0 : 1;
+}
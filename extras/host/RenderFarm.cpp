@@ -0,0 +1,537 @@
+// Renders one input file through every combination of a parameter sweep, in parallel.
+//
+//   renderfarm <input.wav> <sweep.txt> <output dir> [threads]
+//
+// The sweep file has one line per swept parameter, with raw controller values (0-1023 for most, see
+// RegisterParams in Z4.h for the others). Lists and evenly spaced ranges are supported, every
+// combination becomes one job, parameters not listed keep the defaults below:
+//
+//   # decay x size x shimmer, 4 x 3 x 2 = 24 renders
+//   tail = 6                  # seconds rendered after the input ends
+//   Decay = 100, 300, 600, 1023
+//   SizeLate = 200:1023:3     # from:to:count
+//   Shimmer = 0, 36
+//
+// The input (16/24/32 bit PCM or 32 bit float WAV, mono or stereo) is memory mapped once and read by
+// all jobs. Jobs are spread over per-thread queues, an idle thread steals from the others. Each job
+// writes a 32 bit float stereo WAV, and jobs.csv lists the parameters and render time of every job
+// (or "failed" when its output couldn't be written).
+//
+// Needs the Polygons library sources built for the host, e.g.
+//   g++ -std=c++17 -O2 -pthread -DZ4_HOST -I<Polygons>/src -I../../src RenderFarm.cpp -o renderfarm
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "ControllerZ4.h"
+
+using namespace Z4;
+
+const char* Names[Parameter::COUNT] =
+{
+    "Decay", "SizeEarly", "SizeLate", "Diffuse", "LowCutPre", "HighCutPre", "Modulate", "Mix",
+    "EarlyStages", "Interpolation", "Shimmer", "InputMode", "LowCutPost", "HighCutPost", "InGain", "OutGain",
+    "Active", "Freeze",
+};
+
+// Stereo input, linear interpolation, no shimmer, 0dB out
+const uint16_t Defaults[Parameter::COUNT] = {300, 512, 512, 512, 1023, 0, 300, 512, 512, 3, 0, 0, 1023, 0, 0, 512, 1, 0};
+
+struct Sweep
+{
+    std::vector<int> Params;
+    std::vector<std::vector<uint16_t>> Values;
+    float Tail = 5;
+};
+
+struct Job
+{
+    int Index;
+    uint16_t Values[Parameter::COUNT];
+    int Thread;
+    bool Stolen;
+    double Millis;      // wall clock
+    double CpuMillis;   // CPU time of the rendering thread, what the job costs
+    bool Failed;        // the output couldn't be written, the times are not set
+};
+
+// ---------------------------------------------------------------- input
+
+class MappedWav
+{
+    void* Map = MAP_FAILED;
+    size_t MapSize = 0;
+
+public:
+    const uint8_t* Data = nullptr;
+    int Channels = 0;
+    int Bits = 0;
+    bool IsFloat = false;
+    int Samplerate = 0;
+    size_t Frames = 0;
+
+    bool Open(const char* path)
+    {
+        int fd = open(path, O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size < 44)
+        {
+            close(fd);
+            return false;
+        }
+        MapSize = st.st_size;
+        Map = mmap(nullptr, MapSize, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (Map == MAP_FAILED)
+            return false;
+
+        auto bytes = (const uint8_t*)Map;
+        if (memcmp(bytes, "RIFF", 4) != 0 || memcmp(bytes + 8, "WAVE", 4) != 0)
+            return false;
+
+        size_t pos = 12;
+        while (pos + 8 <= MapSize)
+        {
+            uint32_t chunkSize;
+            memcpy(&chunkSize, bytes + pos + 4, 4);
+            const uint8_t* chunk = bytes + pos + 8;
+            if (memcmp(bytes + pos, "fmt ", 4) == 0 && chunkSize >= 16)
+            {
+                uint16_t format, channels, bits;
+                uint32_t rate;
+                memcpy(&format, chunk, 2);
+                memcpy(&channels, chunk + 2, 2);
+                memcpy(&rate, chunk + 4, 4);
+                memcpy(&bits, chunk + 14, 2);
+                if (format == 0xFFFE && chunkSize >= 26)
+                    memcpy(&format, chunk + 24, 2); // extensible, the sub format starts with the plain tag
+                Channels = channels;
+                Bits = bits;
+                IsFloat = format == 3;
+                Samplerate = rate;
+            }
+            else if (memcmp(bytes + pos, "data", 4) == 0)
+            {
+                Data = chunk;
+                size_t available = MapSize - (pos + 8);
+                size_t size = chunkSize < available ? chunkSize : available;
+                Frames = Channels > 0 && Bits > 0 ? size / (Channels * Bits / 8) : 0;
+                break;
+            }
+            pos += 8 + chunkSize + (chunkSize & 1);
+        }
+
+        bool supported = (IsFloat && Bits == 32) || (!IsFloat && (Bits == 16 || Bits == 24 || Bits == 32));
+        return Data != nullptr && (Channels == 1 || Channels == 2) && supported;
+    }
+
+    ~MappedWav()
+    {
+        if (Map != MAP_FAILED)
+            munmap(Map, MapSize);
+    }
+
+    inline float Sample(size_t frame, int channel) const
+    {
+        channel = channel < Channels ? channel : 0;
+        const uint8_t* p = Data + (frame * Channels + channel) * (Bits / 8);
+        if (IsFloat)
+        {
+            float value;
+            memcpy(&value, p, 4);
+            return value;
+        }
+        if (Bits == 16)
+        {
+            int16_t value;
+            memcpy(&value, p, 2);
+            return value * (1.0f / 32768.0f);
+        }
+        if (Bits == 24)
+        {
+            int32_t value = (int32_t)((uint32_t)p[0] << 8 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 24);
+            return value * (1.0f / 2147483648.0f);
+        }
+        int32_t value;
+        memcpy(&value, p, 4);
+        return value * (1.0f / 2147483648.0f);
+    }
+};
+
+// ---------------------------------------------------------------- sweep spec
+
+bool ParseSweep(const char* path, Sweep* sweep)
+{
+    FILE* file = fopen(path, "r");
+    if (file == nullptr)
+        return false;
+
+    char line[1024];
+    int lineNumber = 0;
+    bool ok = true;
+    while (ok && fgets(line, sizeof(line), file) != nullptr)
+    {
+        lineNumber++;
+        char* comment = strchr(line, '#');
+        if (comment != nullptr)
+            *comment = 0;
+
+        char name[64];
+        int consumed = 0;
+        if (sscanf(line, " %63[A-Za-z] = %n", name, &consumed) != 1)
+        {
+            // blank, or something that isn't a name
+            if (strspn(line, " \t\r\n") == strlen(line))
+                continue;
+            fprintf(stderr, "%s:%d: expected <parameter> = <values>\n", path, lineNumber);
+            ok = false;
+            break;
+        }
+        if (consumed == 0)
+        {
+            fprintf(stderr, "%s:%d: expected = after %s\n", path, lineNumber, name);
+            ok = false;
+            break;
+        }
+
+        const char* values = line + consumed;
+        if (strcmp(name, "tail") == 0)
+        {
+            sweep->Tail = atof(values);
+            continue;
+        }
+
+        int param = -1;
+        for (int i = 0; i < Parameter::COUNT; i++)
+            if (strcmp(name, Names[i]) == 0)
+                param = i;
+        if (param < 0)
+        {
+            fprintf(stderr, "%s:%d: unknown parameter %s\n", path, lineNumber, name);
+            ok = false;
+            break;
+        }
+
+        std::vector<uint16_t> list;
+        int from, to, count;
+        if (sscanf(values, "%d : %d : %d", &from, &to, &count) == 3 && count > 0)
+        {
+            for (int i = 0; i < count; i++)
+                list.push_back((uint16_t)(count == 1 ? from : from + (to - from) * i / (count - 1)));
+        }
+        else
+        {
+            char* cursor = (char*)values;
+            while (*cursor != 0)
+            {
+                char* end;
+                long value = strtol(cursor, &end, 10);
+                if (end == cursor)
+                    break;
+                list.push_back((uint16_t)value);
+                cursor = end;
+                while (*cursor == ',' || *cursor == ' ' || *cursor == '\t')
+                    cursor++;
+            }
+        }
+
+        if (list.empty())
+        {
+            fprintf(stderr, "%s:%d: no values for %s\n", path, lineNumber, name);
+            ok = false;
+        }
+        sweep->Params.push_back(param);
+        sweep->Values.push_back(list);
+    }
+
+    fclose(file);
+    return ok;
+}
+
+std::vector<Job> ExpandJobs(const Sweep& sweep)
+{
+    std::vector<Job> jobs;
+    std::vector<size_t> counter(sweep.Params.size(), 0);
+    while (true)
+    {
+        Job job = {};
+        job.Index = (int)jobs.size();
+        memcpy(job.Values, Defaults, sizeof(Defaults));
+        for (size_t i = 0; i < sweep.Params.size(); i++)
+            job.Values[sweep.Params[i]] = sweep.Values[i][counter[i]];
+        jobs.push_back(job);
+
+        // odometer over all combinations
+        size_t k = 0;
+        while (k < counter.size() && ++counter[k] == sweep.Values[k].size())
+            counter[k++] = 0;
+        if (k == counter.size())
+            break;
+    }
+    return jobs;
+}
+
+// ---------------------------------------------------------------- output
+
+void WriteWavHeader(FILE* file, int samplerate, uint32_t frames)
+{
+    uint32_t dataSize = frames * 2 * 4;
+    uint32_t riffSize = 36 + dataSize;
+    uint16_t format = 3, channels = 2, bits = 32, blockAlign = 8;
+    uint32_t fmtSize = 16, byteRate = samplerate * 8, rate = samplerate;
+    fwrite("RIFF", 1, 4, file);
+    fwrite(&riffSize, 4, 1, file);
+    fwrite("WAVEfmt ", 1, 8, file);
+    fwrite(&fmtSize, 4, 1, file);
+    fwrite(&format, 2, 1, file);
+    fwrite(&channels, 2, 1, file);
+    fwrite(&rate, 4, 1, file);
+    fwrite(&byteRate, 4, 1, file);
+    fwrite(&blockAlign, 2, 1, file);
+    fwrite(&bits, 2, 1, file);
+    fwrite("data", 1, 4, file);
+    fwrite(&dataSize, 4, 1, file);
+}
+
+// ---------------------------------------------------------------- rendering
+
+double ThreadCpuMillis()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+bool Render(const MappedWav& input, const Sweep& sweep, const char* outDir, Job* job)
+{
+    auto start = std::chrono::steady_clock::now();
+    double cpuStart = ThreadCpuMillis();
+
+    Controller* controller = new Controller(input.Samplerate);
+    for (int i = 0; i < Parameter::COUNT; i++)
+        controller->SetParameter(i, job->Values[i]);
+
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/job_%04d.wav", outDir, job->Index);
+    FILE* file = fopen(path, "wb");
+    if (file == nullptr)
+    {
+        fprintf(stderr, "job %d: can't create %s\n", job->Index, path);
+        delete controller;
+        job->Failed = true;
+        return false;
+    }
+
+    size_t totalFrames = input.Frames + (size_t)(sweep.Tail * input.Samplerate);
+    WriteWavHeader(file, input.Samplerate, (uint32_t)totalFrames);
+
+    float inL[BUFFER_SIZE], inR[BUFFER_SIZE], outL[BUFFER_SIZE], outR[BUFFER_SIZE];
+    float interleaved[BUFFER_SIZE * 2];
+    float* ins[2] = {inL, inR};
+    float* outs[2] = {outL, outR};
+    bool written = true;
+
+    for (size_t frame = 0; written && frame < totalFrames; frame += BUFFER_SIZE)
+    {
+        for (int i = 0; i < BUFFER_SIZE; i++)
+        {
+            size_t f = frame + i;
+            inL[i] = f < input.Frames ? input.Sample(f, 0) : 0;
+            inR[i] = f < input.Frames ? input.Sample(f, 1) : 0;
+        }
+
+        controller->Process(ins, outs, BUFFER_SIZE);
+
+        size_t count = totalFrames - frame < (size_t)BUFFER_SIZE ? totalFrames - frame : BUFFER_SIZE;
+        for (size_t i = 0; i < count; i++)
+        {
+            interleaved[2 * i] = outL[i];
+            interleaved[2 * i + 1] = outR[i];
+        }
+        written = fwrite(interleaved, sizeof(float), count * 2, file) == count * 2;
+    }
+
+    written = fclose(file) == 0 && written;
+    delete controller;
+    if (!written)
+    {
+        fprintf(stderr, "job %d: writing %s failed\n", job->Index, path);
+        job->Failed = true;
+        return false;
+    }
+
+    job->Millis = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    job->CpuMillis = ThreadCpuMillis() - cpuStart;
+    return true;
+}
+
+// One queue per worker. The owner takes jobs from the back, thieves from the front
+class WorkQueue
+{
+    std::mutex Lock;
+    std::deque<Job*> Jobs;
+
+public:
+    void Push(Job* job)
+    {
+        std::lock_guard<std::mutex> guard(Lock);
+        Jobs.push_back(job);
+    }
+
+    Job* Pop()
+    {
+        std::lock_guard<std::mutex> guard(Lock);
+        if (Jobs.empty())
+            return nullptr;
+        Job* job = Jobs.back();
+        Jobs.pop_back();
+        return job;
+    }
+
+    Job* Steal()
+    {
+        std::lock_guard<std::mutex> guard(Lock);
+        if (Jobs.empty())
+            return nullptr;
+        Job* job = Jobs.front();
+        Jobs.pop_front();
+        return job;
+    }
+};
+
+int main(int argc, char** argv)
+{
+    if (argc < 4)
+    {
+        fprintf(stderr, "usage: renderfarm <input.wav> <sweep.txt> <output dir> [threads]\n");
+        return 1;
+    }
+
+    MappedWav input;
+    if (!input.Open(argv[1]))
+    {
+        fprintf(stderr, "can't read %s, expected a mono or stereo PCM or float WAV\n", argv[1]);
+        return 1;
+    }
+    if (input.Samplerate > FS_MAX)
+        fprintf(stderr, "warning: %dHz is above FS_MAX (%d), long delays will be clamped\n", input.Samplerate, FS_MAX);
+
+    Sweep sweep;
+    if (!ParseSweep(argv[2], &sweep))
+    {
+        fprintf(stderr, "can't parse the sweep %s\n", argv[2]);
+        return 1;
+    }
+
+    const char* outDir = argv[3];
+    mkdir(outDir, 0755);
+
+    int threadCount = argc > 4 ? atoi(argv[4]) : (int)std::thread::hardware_concurrency();
+    if (threadCount < 1)
+        threadCount = 1;
+
+    std::vector<Job> jobs = ExpandJobs(sweep);
+    std::vector<WorkQueue> queues(threadCount);
+    for (size_t i = 0; i < jobs.size(); i++)
+        queues[i % threadCount].Push(&jobs[i]);
+
+    // shared tables are built once, before any engine is created on a worker
+    LfoTable::Init();
+
+    printf("%d jobs, %zu frames at %dHz + %.1fs tail, %d threads\n", (int)jobs.size(), input.Frames, input.Samplerate, sweep.Tail, threadCount);
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> threads;
+    bool failed = false;
+    std::mutex failedLock;
+    for (int t = 0; t < threadCount; t++)
+    {
+        threads.emplace_back([&, t]()
+        {
+            while (true)
+            {
+                Job* job = queues[t].Pop();
+                bool stolen = false;
+                for (int k = 1; job == nullptr && k < threadCount; k++)
+                {
+                    job = queues[(t + k) % threadCount].Steal();
+                    stolen = job != nullptr;
+                }
+                if (job == nullptr)
+                    return; // every queue is empty, jobs are never added after the start
+
+                job->Thread = t;
+                job->Stolen = stolen;
+                if (!Render(input, sweep, outDir, job))
+                {
+                    std::lock_guard<std::mutex> guard(failedLock);
+                    failed = true;
+                }
+            }
+        });
+    }
+    for (auto& thread : threads)
+        thread.join();
+
+    double wallMillis = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    Log::Drain();
+
+    char csvPath[1024];
+    snprintf(csvPath, sizeof(csvPath), "%s/jobs.csv", outDir);
+    FILE* csv = fopen(csvPath, "w");
+    double totalCpuMillis = 0;
+    double audioSeconds = (input.Frames + sweep.Tail * input.Samplerate) / (double)input.Samplerate;
+    if (csv != nullptr)
+    {
+        fprintf(csv, "job,file,thread,stolen,millis,cpu_millis,realtime");
+        for (int i = 0; i < Parameter::COUNT; i++)
+            fprintf(csv, ",%s", Names[i]);
+        fprintf(csv, "\n");
+    }
+    int rendered = 0;
+    for (auto& job : jobs)
+    {
+        if (!job.Failed)
+        {
+            totalCpuMillis += job.CpuMillis;
+            rendered++;
+        }
+        if (csv == nullptr)
+            continue;
+        fprintf(csv, "%d,job_%04d.wav,%d,%d,", job.Index, job.Index, job.Thread, job.Stolen ? 1 : 0);
+        if (job.Failed)
+            fprintf(csv, ",,failed");
+        else if (job.CpuMillis > 0)
+            fprintf(csv, "%.1f,%.1f,%.1f", job.Millis, job.CpuMillis, audioSeconds * 1000 / job.CpuMillis);
+        else
+            fprintf(csv, "%.1f,%.1f,", job.Millis, job.CpuMillis); // too short for the CPU clock
+        for (int i = 0; i < Parameter::COUNT; i++)
+            fprintf(csv, ",%d", job.Values[i]);
+        fprintf(csv, "\n");
+    }
+    if (csv != nullptr)
+        fclose(csv);
+
+    // CPU time summed over the jobs against the wall clock is how many jobs ran at once on average,
+    // it can't go above the number of cores however many threads are asked for
+    printf("done in %.0fms, %.0fms CPU, %.2fx CPU/wall", wallMillis, totalCpuMillis, totalCpuMillis / wallMillis);
+    if (totalCpuMillis > 0)
+        printf(", %.1fx realtime per job", audioSeconds * 1000 * rendered / totalCpuMillis);
+    if (rendered < (int)jobs.size())
+        printf(", %d of %d jobs failed", (int)jobs.size() - rendered, (int)jobs.size());
+    printf("\n");
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,224 @@
+// Runs the float and the Q31 controller, each with the ring and the FDN tank, over the parameter / shimmer
+// matrix with the real-time checker enabled, then plays dense automation timelines through them.
+// Fails if anything in the audio path allocates, locks, blocks or overflows the buffer pool.
+//
+// Needs the Polygons library sources built for the host, e.g.
+//   g++ -std=c++17 -O1 -g -rdynamic -DZ4_HOST -DZ4_RT_CHECK -I<Polygons>/src -I../../src RtCheck.cpp -ldl -o rtcheck
+
+#define Z4_RT_CHECK_IMPLEMENTATION
+#include <stdlib.h>
+#include "ControllerZ4.h"
+
+using namespace Z4;
+
+const int BlocksPerCase = 150; // long enough for the shimmer to warm up and restart grains
+const int AutomationBlocks = 200;
+const int AutomationEvents = 1000;
+int MaxValue[Parameter::COUNT];
+uint32_t NoiseSeed = 1;
+
+inline uint32_t Random()
+{
+    NoiseSeed = NoiseSeed * 1664525u + 1013904223u;
+    return NoiseSeed >> 8;
+}
+
+inline void Noise(float* dest)
+{
+    *dest = Random() * (1.0f / 16777216.0f) - 0.5f;
+}
+
+inline void Noise(int32_t* dest)
+{
+    *dest = (int32_t)((Random() << 8) - 0x80000000u) >> 1; // -6dBFS in Q31
+}
+
+void SetMaxValues()
+{
+    for (int i = 0; i < Parameter::COUNT; i++)
+        MaxValue[i] = 1023;
+    MaxValue[Parameter::Interpolation] = 8;
+    MaxValue[Parameter::Shimmer] = 64;
+    MaxValue[Parameter::InputMode] = 8;
+    MaxValue[Parameter::Active] = 1;
+    MaxValue[Parameter::Freeze] = 1;
+}
+
+// The Buffers pool size isn't exposed by Polygons, so it's counted: buffers are requested and held until
+// the pool hands out a null or an already held buffer
+int ProbePoolSize(float** held, int depth)
+{
+    auto handle = Buffers::Request();
+    if (handle.Ptr == nullptr || depth >= 256)
+        return depth;
+    for (int i = 0; i < depth; i++)
+    {
+        if (held[i] == handle.Ptr)
+            return depth;
+    }
+    held[depth] = handle.Ptr;
+    return ProbePoolSize(held, depth + 1);
+}
+
+template<typename Sample, typename TProcess>
+int RunBlocks(int blocks, const char* label, TProcess process)
+{
+    static Sample inL[BUFFER_SIZE], inR[BUFFER_SIZE], outL[BUFFER_SIZE], outR[BUFFER_SIZE];
+    Log::Drain();
+    int before = RtCheck::GetTotalCount();
+    Sample* ins[2] = {inL, inR};
+    Sample* outs[2] = {outL, outR};
+    for (int b = 0; b < blocks; b++)
+    {
+        for (int i = 0; i < BUFFER_SIZE; i++)
+        {
+            Noise(&inL[i]);
+            Noise(&inR[i]);
+        }
+        process(ins, outs);
+    }
+
+    int found = RtCheck::GetTotalCount() - before;
+    if (found > 0)
+        fprintf(stderr, "  %d violations in %s\n", found, label);
+    return found;
+}
+
+template<typename TController>
+int RunBlocks(TController* controller, int blocks, const char* label)
+{
+    typedef typename TController::Sample Sample;
+    return RunBlocks<Sample>(blocks, label, [&](Sample** ins, Sample** outs) { controller->Process(ins, outs, BUFFER_SIZE); });
+}
+
+template<typename TController>
+TController* Create(TankMode mode)
+{
+    auto controller = new TController(48000);
+    for (int i = 0; i < Parameter::COUNT; i++)
+        controller->SetParameter(i, MaxValue[i] / 2);
+    controller->SetParameter(Parameter::Active, 1);
+    controller->SetParameter(Parameter::Freeze, 0);
+    controller->SetTankMode(mode);
+    return controller;
+}
+
+// Every distinct shimmer mode x input mode x quality setting, then each parameter on its own
+// at the ends and middle of its range
+template<typename TController>
+int RunMatrix(const char* engine, TankMode mode)
+{
+    auto controller = Create<TController>(mode);
+    const char* tank = mode == TankMode::Fdn ? "fdn" : "ring";
+    int cases = 0;
+    char label[128];
+    double lastShimmer = -1;
+    for (int s = 0; s <= MaxValue[Parameter::Shimmer]; s++)
+    {
+        controller->SetParameter(Parameter::Shimmer, s);
+        double shimmer = controller->GetScaledParameter(Parameter::Shimmer);
+        if (shimmer == lastShimmer)
+            continue;
+        lastShimmer = shimmer;
+
+        double lastInput = -1;
+        for (int m = 0; m <= MaxValue[Parameter::InputMode]; m++)
+        {
+            controller->SetParameter(Parameter::InputMode, m);
+            double input = controller->GetScaledParameter(Parameter::InputMode);
+            if (input == lastInput)
+                continue;
+            lastInput = input;
+
+            double lastQuality = -1;
+            for (int q = 0; q <= MaxValue[Parameter::Interpolation]; q++)
+            {
+                controller->SetParameter(Parameter::Interpolation, q);
+                double quality = controller->GetScaledParameter(Parameter::Interpolation);
+                if (quality == lastQuality)
+                    continue;
+                lastQuality = quality;
+
+                snprintf(label, sizeof(label), "%s %s, shimmer %d, input mode %d, quality %d", engine, tank, (int)shimmer, (int)input, (int)quality);
+                RunBlocks(controller, BlocksPerCase, label);
+                cases++;
+            }
+        }
+    }
+
+    for (int p = 0; p < Parameter::COUNT; p++)
+    {
+        int values[3] = {0, MaxValue[p] / 2, MaxValue[p]};
+        for (int v = 0; v < 3; v++)
+        {
+            controller->SetParameter(p, values[v]);
+            snprintf(label, sizeof(label), "%s %s, parameter %d = %d", engine, tank, p, values[v]);
+            RunBlocks(controller, 20, label);
+            cases++;
+        }
+    }
+
+    delete controller;
+    return cases;
+}
+
+// Random changes of every parameter, shimmer included, played through Process with a timeline at
+// sample and at coarse resolution. Unprepared shimmer modes must be skipped rather than allocated
+template<typename TController>
+int RunAutomation(const char* engine, TankMode mode)
+{
+    typedef typename TController::Sample Sample;
+    static AutomationTimeline<AutomationEvents> timeline;
+    const char* tank = mode == TankMode::Fdn ? "fdn" : "ring";
+    char label[128];
+    int cases = 0;
+
+    for (int prepared = 0; prepared < 2; prepared++)
+    {
+        for (int resolution : {1, 32})
+        {
+            auto controller = Create<TController>(mode);
+            timeline.Clear();
+            timeline.Resolution = resolution;
+            for (int i = 0; i < AutomationEvents; i++)
+            {
+                int param = Random() % Parameter::COUNT;
+                timeline.Add(Random() % (AutomationBlocks * BUFFER_SIZE), param, (uint16_t)(Random() % (MaxValue[param] + 1)));
+            }
+            if (prepared)
+                controller->PrepareAutomation(timeline);
+
+            snprintf(label, sizeof(label), "%s %s, automation, resolution %d%s", engine, tank, resolution, prepared ? "" : ", unprepared");
+            RunBlocks<Sample>(AutomationBlocks, label,
+                [&](Sample** ins, Sample** outs) { controller->Process(ins, outs, BUFFER_SIZE, timeline); });
+            delete controller;
+            cases++;
+        }
+    }
+    return cases;
+}
+
+int main()
+{
+    SetMaxValues();
+
+    // the host runs the engine on PoolBuffer's own per-thread pool, so the smaller of the two is the limit
+    float* held[256];
+    int poolSize = ProbePoolSize(held, 0);
+    printf("RtCheck: Polygons::Buffers holds %d buffers, the host pool %d\n", poolSize, PoolBuffer::HostPoolSize);
+    RtCheck::SetPoolSize(poolSize < PoolBuffer::HostPoolSize ? poolSize : PoolBuffer::HostPoolSize);
+
+    int cases = 0;
+    for (TankMode mode : {TankMode::Ring, TankMode::Fdn})
+    {
+        cases += RunMatrix<Controller>("float", mode);
+        cases += RunMatrix<ControllerFixed>("q31", mode);
+        cases += RunAutomation<Controller>("float", mode);
+        cases += RunAutomation<ControllerFixed>("q31", mode);
+    }
+
+    Log::Drain();
+    printf("RtCheck: %d cases, buffer pool peak %d of %d\n", cases, RtCheck::PoolPeak(), RtCheck::PoolSize());
+    RtCheck::PrintSummary();
+    return RtCheck::GetTotalCount() == 0 ? 0 : 1;
+}
@@ -0,0 +1,155 @@
+// Checks the engine snapshots (Controller::SaveState / LoadState): a warmed up engine is saved and loaded
+// into a new one, and from then on both have to produce the same output to the bit. Runs for the float
+// and the Q31 engine, with the ring and the FDN tank, with and without shimmer. Also checks that truncated
+// snapshots, snapshots of the other engine type or samplerate, and a buffer too small to save into are
+// all rejected.
+//
+// Needs the Polygons library sources built for the host, e.g.
+//   g++ -std=c++17 -O2 -DZ4_HOST -I<Polygons>/src -I../../src SnapshotCheck.cpp -o snapshotcheck
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include "ControllerZ4.h"
+
+using namespace Z4;
+
+const int WarmupBlocks = 300; // long enough for the shimmer grains to be mid flight
+const int CompareBlocks = 200;
+
+struct Case
+{
+    const char* Name;
+    int Shimmer;
+    int InputMode;
+};
+
+uint32_t Seed = 1;
+
+uint32_t Random()
+{
+    Seed = Seed * 1664525u + 1013904223u;
+    return Seed >> 8;
+}
+
+void Noise(float* dest) { *dest = (Random() * (1.0f / 16777216.0f) - 0.5f) * 0.5f; }
+void Noise(int32_t* dest) { *dest = (int32_t)((Random() << 8) - 0x80000000u) >> 2; }
+
+void QuietSink(int, const char*) { }
+
+int Failed = 0;
+
+void Expect(bool condition, const char* label, const char* what)
+{
+    if (!condition)
+    {
+        printf("%-36s FAILED: %s\n", label, what);
+        Failed++;
+    }
+}
+
+template<typename TController>
+TController* Create(const Case& c, TankMode mode, int samplerate = 48000)
+{
+    // Decay, SizeEarly, SizeLate, Diffuse, LowCutPre, HighCutPre, Modulate, Mix,
+    // EarlyStages, Interpolation, Shimmer, InputMode, LowCutPost, HighCutPost, InGain, OutGain, Active, Freeze
+    int values[Parameter::COUNT] = {300, 512, 512, 512, 1023, 0, 300, 512, 512, 3, c.Shimmer, c.InputMode, 1023, 0, 0, 512, 1, 0};
+    auto controller = new TController(samplerate);
+    for (int i = 0; i < Parameter::COUNT; i++)
+        controller->SetParameter(i, values[i]);
+    controller->SetTankMode(mode);
+    return controller;
+}
+
+template<typename TController>
+void Process(TController* controller, int blocks, typename TController::Sample* output)
+{
+    typedef typename TController::Sample Sample;
+    Sample inL[BUFFER_SIZE], inR[BUFFER_SIZE], outL[BUFFER_SIZE], outR[BUFFER_SIZE];
+    Sample* ins[2] = {inL, inR};
+    Sample* outs[2] = {outL, outR};
+    for (int b = 0; b < blocks; b++)
+    {
+        for (int i = 0; i < BUFFER_SIZE; i++)
+        {
+            Noise(&inL[i]);
+            Noise(&inR[i]);
+        }
+        controller->Process(ins, outs, BUFFER_SIZE);
+        if (output != nullptr)
+        {
+            memcpy(&output[(b * 2) * BUFFER_SIZE], outL, sizeof(outL));
+            memcpy(&output[(b * 2 + 1) * BUFFER_SIZE], outR, sizeof(outR));
+        }
+    }
+}
+
+template<typename TController, typename TOther>
+void Check(const char* engine, const Case& c, TankMode mode)
+{
+    typedef typename TController::Sample Sample;
+    char label[128];
+    snprintf(label, sizeof(label), "%s %s, %s", engine, mode == TankMode::Fdn ? "fdn" : "ring", c.Name);
+
+    auto original = Create<TController>(c, mode);
+    Seed = 1;
+    Process(original, WarmupBlocks, (Sample*)nullptr);
+
+    size_t size = original->GetStateSize();
+    std::vector<uint8_t> snapshot(size);
+    Expect(original->SaveState(snapshot.data(), size) == size, label, "SaveState didn't write GetStateSize bytes");
+    Expect(original->SaveState(snapshot.data(), size - 1) == 0, label, "SaveState wrote into a buffer that was too small");
+    original->SaveState(snapshot.data(), size);
+
+    // the copy starts from other settings, the snapshot has to bring all of them back
+    Case other = {"", 0, 0};
+    auto copy = Create<TController>(other, mode == TankMode::Fdn ? TankMode::Ring : TankMode::Fdn);
+    Expect(copy->LoadState(snapshot.data(), size), label, "LoadState rejected a complete snapshot");
+
+    std::vector<Sample> expected(CompareBlocks * 2 * BUFFER_SIZE), actual(CompareBlocks * 2 * BUFFER_SIZE);
+    uint32_t seed = Seed;
+    Process(original, CompareBlocks, expected.data());
+    Seed = seed;
+    Process(copy, CompareBlocks, actual.data());
+    Expect(memcmp(expected.data(), actual.data(), expected.size() * sizeof(Sample)) == 0, label, "output differs after loading");
+
+    // truncated anywhere, from inside the header to the last byte
+    for (size_t cut : {(size_t)0, (size_t)4, (size_t)16, size / 2, size - 1})
+        Expect(!copy->LoadState(snapshot.data(), cut), label, "LoadState accepted a truncated snapshot");
+
+    auto wrongRate = Create<TController>(c, mode, 44100);
+    Expect(!wrongRate->LoadState(snapshot.data(), size), label, "LoadState accepted a snapshot of another samplerate");
+    auto wrongEngine = Create<TOther>(c, mode);
+    Expect(!wrongEngine->LoadState(snapshot.data(), size), label, "LoadState accepted a snapshot of the other engine");
+
+    printf("%-36s %7d bytes\n", label, (int)size);
+    delete original;
+    delete copy;
+    delete wrongRate;
+    delete wrongEngine;
+}
+
+int main()
+{
+    Log::SetSink(QuietSink);
+
+    // Shimmer and InputMode are raw values, see ScaleParameter
+    Case cases[] =
+    {
+        {"plain",                   0,  0},
+        {"shimmer fast up, stereo", 36, 8},
+        {"shimmer, dual mono",      12, 6},
+    };
+
+    for (TankMode mode : {TankMode::Ring, TankMode::Fdn})
+    {
+        for (auto& c : cases)
+        {
+            Check<Controller, ControllerFixed>("float", c, mode);
+            Check<ControllerFixed, Controller>("q31", c, mode);
+        }
+    }
+
+    printf("%d failed\n", Failed);
+    return Failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,225 @@
+// Compares the ring tank with the FDN tank (TankMode) on the host: time per block, and for the impulse
+// response the normalized echo density (Abel & Huang), how long the tail takes to become fully dense,
+// and the T60 it actually decays with. The timings are host timings only and say nothing about the Teensy.
+//
+// Needs the Polygons library sources built for the host, e.g.
+//   g++ -std=c++17 -O2 -DZ4_HOST -I<Polygons>/src -I../../src TankCompare.cpp -o tankcompare
+
+#include <stdlib.h>
+#include <chrono>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include "ControllerZ4.h"
+
+using namespace Z4;
+
+const int Samplerate = 48000;
+const int ImpulseSeconds = 6;
+const int TimedBlocks = 250;
+const int TimedPasses = 20;
+const int DensityWindow = Samplerate / 50; // 20ms
+const int DensitySmoothing = Samplerate / 20; // the density of noise still fluctuates by +-0.1 in 20ms, it's averaged over 50ms
+const int DensityPeriod = Samplerate * 3 / 10; // the mean density is taken over the first 300ms
+
+struct Case
+{
+    const char* Name;
+    int Values[Parameter::COUNT];
+};
+
+struct Result
+{
+    double Nanos;
+    double Cycles;
+    double MixingTime;  // ms from the impulse until the echo density reaches 0.9
+    double Density;     // mean echo density over the first 300ms
+    double T60;
+};
+
+uint32_t NoiseSeed = 1;
+
+float Noise()
+{
+    NoiseSeed = NoiseSeed * 1664525u + 1013904223u;
+    return ((NoiseSeed >> 8) * (1.0f / 16777216.0f) - 0.5f) * 0.5f;
+}
+
+inline uint64_t Cycles()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+Controller* Create(const Case& c, TankMode mode)
+{
+    auto controller = new Controller(Samplerate);
+    for (int i = 0; i < Parameter::COUNT; i++)
+        controller->SetParameter(i, c.Values[i]);
+    controller->SetTankMode(mode);
+    Log::Drain();
+    return controller;
+}
+
+// Fraction of the samples in each window that lie outside one standard deviation, relative to
+// what Gaussian noise gives (erfc(1/sqrt(2))). 1 is as dense as noise
+std::vector<double> EchoDensity(const std::vector<float>& ir)
+{
+    std::vector<double> density(ir.size(), 0);
+    int half = DensityWindow / 2;
+    for (size_t t = half; t + half < ir.size(); t += 48)
+    {
+        double power = 0;
+        for (size_t i = t - half; i < t + half; i++)
+            power += ir[i] * (double)ir[i];
+        double sigma = sqrt(power / DensityWindow);
+        int outside = 0;
+        for (size_t i = t - half; i < t + half; i++)
+            outside += fabs(ir[i]) > sigma;
+        double value = outside / (double)DensityWindow / 0.3173105;
+        for (size_t i = t; i < t + 48 && i < ir.size(); i++)
+            density[i] = value;
+    }
+    return density;
+}
+
+// Schroeder backward integration, T60 extrapolated from the -5 to -25dB range
+double MeasureT60(const std::vector<float>& ir)
+{
+    std::vector<double> energy(ir.size() + 1, 0);
+    for (int i = (int)ir.size() - 1; i >= 0; i--)
+        energy[i] = energy[i + 1] + ir[i] * (double)ir[i];
+
+    int start = -1, end = -1;
+    for (size_t i = 0; i < ir.size(); i++)
+    {
+        double db = 10 * log10(energy[i] / energy[0] + 1e-30);
+        if (start < 0 && db < -5)
+            start = (int)i;
+        if (end < 0 && db < -25)
+        {
+            end = (int)i;
+            break;
+        }
+    }
+    if (start < 0 || end < 0)
+        return 0;
+    return (end - start) / (double)Samplerate * 3;
+}
+
+// One pass of steady noise through the engine, returns ns and cycles per block
+void TimePass(Controller* controller, double* nanos, double* cycles)
+{
+    float inL[BUFFER_SIZE], inR[BUFFER_SIZE], outL[BUFFER_SIZE], outR[BUFFER_SIZE];
+    float* ins[2] = {inL, inR};
+    float* outs[2] = {outL, outR};
+
+    double n = 0, c = 0;
+    for (int block = 0; block < TimedBlocks; block++)
+    {
+        for (int i = 0; i < BUFFER_SIZE; i++)
+        {
+            inL[i] = Noise();
+            inR[i] = Noise();
+        }
+        auto t0 = std::chrono::steady_clock::now();
+        uint64_t c0 = Cycles();
+        controller->Process(ins, outs, BUFFER_SIZE);
+        c += Cycles() - c0;
+        n += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count();
+    }
+    *nanos = fmin(*nanos, n / TimedBlocks);
+    *cycles = fmin(*cycles, c / TimedBlocks);
+}
+
+void Measure(const Case& c, Result* ring, Result* fdn)
+{
+    // The host is noisy: the two tanks take turns, and the fastest pass of each is kept
+    Controller* ringEngine = Create(c, TankMode::Ring);
+    Controller* fdnEngine = Create(c, TankMode::Fdn);
+    ring->Nanos = ring->Cycles = fdn->Nanos = fdn->Cycles = 1e30;
+    NoiseSeed = 1;
+    for (int pass = 0; pass < TimedPasses; pass++)
+    {
+        TimePass(ringEngine, &ring->Nanos, &ring->Cycles);
+        TimePass(fdnEngine, &fdn->Nanos, &fdn->Cycles);
+    }
+    delete ringEngine;
+    delete fdnEngine;
+
+    Result* results[2] = {ring, fdn};
+    for (int m = 0; m < 2; m++)
+    {
+        auto result = results[m];
+        auto controller = Create(c, m == 0 ? TankMode::Ring : TankMode::Fdn);
+        float inL[BUFFER_SIZE], inR[BUFFER_SIZE], outL[BUFFER_SIZE], outR[BUFFER_SIZE];
+        float* ins[2] = {inL, inR};
+        float* outs[2] = {outL, outR};
+
+        // impulse response, left output
+        std::vector<float> ir;
+        int blocks = ImpulseSeconds * Samplerate / BUFFER_SIZE;
+        for (int block = 0; block < blocks; block++)
+        {
+            for (int i = 0; i < BUFFER_SIZE; i++)
+            {
+                inL[i] = block == 0 && i == 0 ? 0.5f : 0;
+                inR[i] = inL[i];
+            }
+            controller->Process(ins, outs, BUFFER_SIZE);
+            ir.insert(ir.end(), outL, outL + BUFFER_SIZE);
+        }
+        delete controller;
+
+        auto density = EchoDensity(ir);
+        size_t mixed = 0;
+        double smoothed = 0;
+        for (size_t i = 0; i < density.size(); i++)
+        {
+            smoothed += density[i] - (i >= DensitySmoothing ? density[i - DensitySmoothing] : 0);
+            if (smoothed >= 0.9 * DensitySmoothing)
+            {
+                mixed = i - DensitySmoothing / 2;
+                break;
+            }
+        }
+        double sum = 0;
+        for (size_t i = 0; i < DensityPeriod; i++)
+            sum += density[i];
+
+        result->MixingTime = mixed * 1000.0 / Samplerate;
+        result->Density = sum / DensityPeriod;
+        result->T60 = MeasureT60(ir);
+    }
+}
+
+int main()
+{
+    // Decay, SizeEarly, SizeLate, Diffuse, LowCutPre, HighCutPre, Modulate, Mix,
+    // EarlyStages, Interpolation, Shimmer, InputMode, LowCutPost, HighCutPost, InGain, OutGain, Active, Freeze
+    Case cases[] =
+    {
+        {"default",             {300, 512, 512, 512, 1023, 0, 300, 1023, 512, 3, 0, 0, 1023, 0, 0, 512, 1, 0}},
+        {"no early",            {300, 512, 512, 512, 1023, 0, 300, 1023, 0,   3, 0, 0, 1023, 0, 0, 512, 1, 0}},
+        {"low diffusion",       {300, 512, 512, 1023, 1023, 0, 300, 1023, 512, 3, 0, 0, 1023, 0, 0, 512, 1, 0}},
+        {"large, long",         {700, 900, 900, 512, 1023, 0, 300, 1023, 512, 3, 0, 0, 1023, 0, 0, 512, 1, 0}},
+        {"small, short",        {100, 200, 150, 512, 1023, 0, 300, 1023, 512, 3, 0, 0, 1023, 0, 0, 512, 1, 0}},
+        {"true stereo",         {300, 512, 512, 512, 1023, 0, 300, 1023, 512, 3, 0, 8, 1023, 0, 0, 512, 1, 0}},
+    };
+
+    printf("%-16s %-5s %9s %11s %11s %9s %8s\n", "", "tank", "us/block", "cycles/blk", "mixing ms", "density", "T60 s");
+    for (auto& c : cases)
+    {
+        Result ring, fdn;
+        Measure(c, &ring, &fdn);
+        printf("%-16s %-5s %9.2f %11.0f %11.1f %9.3f %8.2f\n", c.Name, "ring",
+            ring.Nanos / 1000, ring.Cycles, ring.MixingTime, ring.Density, ring.T60);
+        printf("%-16s %-5s %9.2f %11.0f %11.1f %9.3f %8.2f\n", "", "fdn",
+            fdn.Nanos / 1000, fdn.Cycles, fdn.MixingTime, fdn.Density, fdn.T60);
+    }
+    return 0;
+}
@@ -0,0 +1,99 @@
+#pragma once
+#include <stdint.h>
+
+namespace Z4
+{
+    struct ParameterEvent
+    {
+        uint64_t Time;  // in samples, on the controller's clock (Controller::GetSamplePosition)
+        uint16_t Param;
+        uint16_t Value; // raw value, as passed to Controller::SetParameter
+    };
+
+    // Timestamped parameter changes for Controller::Process, kept sorted by time in a fixed array.
+    // Events are consumed as the controller's clock passes them, Rewind() replays the timeline.
+    //
+    // Resolution sets how finely blocks are split: all events that fall within Resolution samples
+    // of a split are applied together at the split, with one update of the derived state.
+    // 1 is sample accurate, larger values trade timing for fewer, longer sub-blocks under dense automation.
+    template<int Capacity>
+    class AutomationTimeline
+    {
+        ParameterEvent Events[Capacity];
+        int Count;
+        int Cursor;
+
+    public:
+        int Resolution;
+
+        AutomationTimeline()
+        {
+            Count = 0;
+            Cursor = 0;
+            Resolution = 1;
+        }
+
+        // Events added in time order are appended, others are inserted after any event with the same time.
+        // Returns false when the timeline is full
+        bool Add(uint64_t time, int param, uint16_t value)
+        {
+            if (Count >= Capacity)
+                return false;
+
+            int i = Count;
+            while (i > Cursor && Events[i - 1].Time > time)
+            {
+                Events[i] = Events[i - 1];
+                i--;
+            }
+            Events[i].Time = time;
+            Events[i].Param = (uint16_t)param;
+            Events[i].Value = value;
+            Count++;
+            return true;
+        }
+
+        void Clear()
+        {
+            Count = 0;
+            Cursor = 0;
+        }
+
+        void Rewind()
+        {
+            Cursor = 0;
+        }
+
+        int GetCount()
+        {
+            return Count;
+        }
+
+        int GetPending()
+        {
+            return Count - Cursor;
+        }
+
+        const ParameterEvent* Get(int index)
+        {
+            return index >= 0 && index < Count ? &Events[index] : nullptr;
+        }
+
+        // Time of the next pending event, false when there is none
+        inline bool Peek(uint64_t* time)
+        {
+            if (Cursor >= Count)
+                return false;
+            *time = Events[Cursor].Time;
+            return true;
+        }
+
+        // Consumes and returns the next event if it is due before the given time
+        inline const ParameterEvent* NextBefore(uint64_t time)
+        {
+            if (Cursor >= Count || Events[Cursor].Time >= time)
+                return nullptr;
+            return &Events[Cursor++];
+        }
+    };
+}
@@ -1,9 +1,14 @@
 
 #pragma once
 
+#include "AutomationTimeline.h"
 #include "Constants.h"
+#include "EngineState.h"
 #include "ParameterZ4.h"
 #include "Utils.h"
+#include "Log.h"
+#include "PoolBuffer.h"
+#include "RtCheck.h"
 #include "Z4Rev.h"
 
 namespace Z4
@@ -13,80 +18,248 @@ namespace Z4
 		Stereo = 0,
 		Left = 1,
 		Right = 2,
+		DualMono = 3,
+		TrueStereo = 4,
 	};
 
-	class Controller
+	// Maps the raw parameter values onto the engine and handles the input routing and gains.
+	// TEngine is Z4Rev (float) or Z4RevFixed (Q31 straight from the codec), see the typedefs below.
+	template<typename TEngine>
+	class BasicController
 	{
+	public:
+		typedef typename TEngine::Sample Sample;
+		typedef typename TEngine::Tank Tank;
+
 	private:
-		Z4Rev Reverb;
+		TEngine Reverb;
 		int samplerate;
 		InputMode inputMode;
 		float inGain;
 		float outGain;
 		bool active;
+		uint64_t samplePosition;
 
 		uint16_t parameters[Parameter::COUNT];
 
 	public:
-		Controller(int samplerate) : Reverb(samplerate) 
+		// The tank can be passed in to place it in a particular memory, otherwise the engine allocates it
+		BasicController(int samplerate, Tank* tank = nullptr) : Reverb(samplerate, tank) 
 		{
 			this->samplerate = samplerate;
 			inputMode = InputMode::Left;
 			inGain = 1.0;
 			outGain = 1.0;
 			active = true;
+			samplePosition = 0;
 		}
 
+		// The engine owns memory, see Z4RevT
+		BasicController(const BasicController&) = delete;
+		BasicController& operator=(const BasicController&) = delete;
+
 		int GetSamplerate()
 		{
 			return samplerate;
 		}
 
+		// Samples processed so far, the clock automation events are timed against
+		uint64_t GetSamplePosition()
+		{
+			return samplePosition;
+		}
+
+		void SetSamplePosition(uint64_t position)
+		{
+			samplePosition = position;
+		}
+
 		uint16_t* GetAllParameters()
 		{
 			return parameters;
 			
 		}
 
+		// Not a parameter, there's no control left for it on the module. Must not run concurrently with Process
+		void SetTankMode(TankMode mode)
+		{
+			Reverb.SetTankMode(mode);
+		}
+
+		TankMode GetTankMode()
+		{
+			return Reverb.GetTankMode();
+		}
+
+		// Delay of the pitch shifted path in samples, so hosts can line up the shimmer with the dry tank
+		int GetShimmerLatency()
+		{
+			return Reverb.GetShimmerLatency();
+		}
+
 		double GetScaledParameter(int param)
+		{
+			return ScaleParameter(param, parameters[param]);
+		}
+
+		double ScaleParameter(int param, uint16_t value)
 		{
 			switch (param)
 			{
-				case Parameter::Decay:				return Polygons::Response2Dec(P(param)) * 30;
-				case Parameter::SizeEarly:			return 0.1 + P(param) * 0.9;
-				case Parameter::SizeLate:			return 0.1 + P(param) * 0.9;
-				case Parameter::Diffuse:			return P(param);
-
-				case Parameter::LowCutPre:			return 200 + Polygons::Response4Oct(P(param)) * 15800;
-				case Parameter::HighCutPre:			return 20 + Polygons::Response4Oct(P(param)) * 1980;
-				case Parameter::Modulate:			return P(param);
-				case Parameter::Mix:				return P(param);
-
-
-				case Parameter::EarlyStages:		return (int)(1 + P(param) * 11.99);
-				case Parameter::Interpolation:		return (int)(P(param, 8));
-				case Parameter::Shimmer:			return (int)(P(param, 64) * 5.999);
-				case Parameter::InputMode:			return (int)(P(param, 8) * 2.999);
-
-				case Parameter::LowCutPost:			return 200 + Polygons::Response4Oct(P(param)) * 15800;
-				case Parameter::HighCutPost:		return 20 + Polygons::Response4Oct(P(param)) * 1980;
-				case Parameter::InGain:				return (int)(P(param) * 40) / 2.0; // 0.5db increments
-				case Parameter::OutGain:			return -20 + P(param) * 40;
+				case Parameter::Decay:				return Polygons::Response2Dec(P(value)) * 30;
+				case Parameter::SizeEarly:			return 0.1 + P(value) * 0.9;
+				case Parameter::SizeLate:			return 0.1 + P(value) * 0.9;
+				case Parameter::Diffuse:			return P(value);
+
+				case Parameter::LowCutPre:			return 200 + Polygons::Response4Oct(P(value)) * 15800;
+				case Parameter::HighCutPre:			return 20 + Polygons::Response4Oct(P(value)) * 1980;
+				case Parameter::Modulate:			return P(value);
+				case Parameter::Mix:				return P(value);
+
+
+				case Parameter::EarlyStages:		return (int)(1 + P(value) * 11.99);
+				case Parameter::Interpolation:		return (int)(P(value, 8) * 2.999);
+				case Parameter::Shimmer:			return (int)(P(value, 64) * 10.999);
+				case Parameter::InputMode:			return (int)(P(value, 8) * 4.999);
+
+				case Parameter::LowCutPost:			return 200 + Polygons::Response4Oct(P(value)) * 15800;
+				case Parameter::HighCutPost:		return 20 + Polygons::Response4Oct(P(value)) * 1980;
+				case Parameter::InGain:				return (int)(P(value) * 40) / 2.0; // 0.5db increments
+				case Parameter::OutGain:			return -20 + P(value) * 40;
 			}
-			return parameters[param];
+			return value;
 		}
 
+		// Control thread only, it may allocate the pitch shifters for a new shimmer mode
 		void SetParameter(int param, uint16_t value)
 		{
+			if (param == Parameter::Shimmer)
+				Reverb.PrepareShimmer((int)ScaleParameter(param, value));
+			Reverb.UpdateDerived(ApplyParameter(param, value));
+		}
+
+		// Processes a block, applying the events of the timeline at the sample they are timed for.
+		// The block is split at the events, and events closer together than the timeline's Resolution
+		// are applied together, so the derived state of the engine is only recomputed once per split.
+		// Shimmer modes must have been prepared with PrepareAutomation, the audio thread can't allocate,
+		// an event for a mode that wasn't is ignored and logged.
+		template<int Capacity>
+		void Process(Sample** inputs, Sample** outputs, int bufferSize, AutomationTimeline<Capacity>& timeline)
+		{
+			Z4_RT_AUDIO_SCOPE();
+
+			int resolution = timeline.Resolution < 1 ? 1 : timeline.Resolution;
+			int start = 0;
+			while (start < bufferSize)
+			{
+				uint64_t now = samplePosition + start;
+				int derived = 0;
+				const ParameterEvent* e;
+				while ((e = timeline.NextBefore(now + resolution)) != nullptr)
+					derived |= ApplyParameter(e->Param, e->Value);
+				if (derived != 0)
+					Reverb.UpdateDerived(derived);
+
+				int end = bufferSize;
+				uint64_t next;
+				if (timeline.Peek(&next) && next < samplePosition + bufferSize)
+					end = (int)(next - samplePosition);
+
+				ProcessBlock(inputs, outputs, start, end - start);
+				start = end;
+			}
+			samplePosition += bufferSize;
+		}
+
+		// Allocates what the events of a timeline will need ahead of time. Call it on the control thread
+		// after adding the events
+		template<int Capacity>
+		void PrepareAutomation(AutomationTimeline<Capacity>& timeline)
+		{
+			for (int i = 0; i < timeline.GetCount(); i++)
+			{
+				auto e = timeline.Get(i);
+				if (e->Param == Parameter::Shimmer)
+					Reverb.PrepareShimmer((int)ScaleParameter(e->Param, e->Value));
+			}
+		}
+
+		// Snapshots of the complete state, parameters included, to checkpoint long renders or to fork
+		// a warmed up engine into variants. A snapshot is raw memory, so it only loads into the same
+		// build and engine type at the same samplerate, which the header checks. About 500Kb for the float
+		// engine and 260Kb for Q31, plus 16-32Kb for each pitch shifter that has been allocated.
+		size_t GetStateSize()
+		{
+			StateWriter counter;
+			WriteState(counter);
+			return counter.GetSize();
+		}
+
+		// Returns the number of bytes written, 0 if the buffer is too small. Call it between Process calls
+		size_t SaveState(uint8_t* data, size_t capacity)
+		{
+			StateWriter writer(data, capacity);
+			WriteState(writer);
+			return writer.IsOk() ? writer.GetSize() : 0;
+		}
+
+		// Must not run concurrently with Process
+		bool LoadState(const uint8_t* data, size_t size)
+		{
+			StateReader reader(data, size);
+			StateHeader header;
+			reader.Read(header);
+			if (!reader.IsOk() || header.Magic != StateHeader().Magic || header.Version != StateHeader().Version)
+			{
+				Z4_LOG_WARN("State: not a snapshot");
+				return false;
+			}
+			if (header.SampleSize != sizeof(Sample) || header.BufferSize != BUFFER_SIZE || header.Samplerate != samplerate)
+			{
+				Z4_LOG_WARN("State: snapshot is for a different engine or samplerate");
+				return false;
+			}
+			if (header.Size != size)
+			{
+				Z4_LOG_WARN("State: snapshot is %d bytes, expected %d", (int)size, (int)header.Size);
+				return false;
+			}
+
+			reader.Read(parameters);
+			reader.Read(inputMode);
+			reader.Read(inGain);
+			reader.Read(outGain);
+			reader.Read(active);
+			reader.Read(samplePosition);
+			bool ok = Reverb.LoadState(reader) && reader.Remaining() == 0;
+			if (!ok)
+				Z4_LOG_ERROR("State: restoring the engine failed");
+			return ok;
+		}
+
+		void Process(Sample** inputs, Sample** outputs, int bufferSize)
+		{
+			Z4_RT_AUDIO_SCOPE();
+			ProcessBlock(inputs, outputs, 0, bufferSize);
+			samplePosition += bufferSize;
+		}
+		
+	private:
+		int ApplyParameter(int param, uint16_t value)
+		{
+			if (param < 0 || param >= Parameter::COUNT)
+				return 0;
+
+			auto scaled = ScaleParameter(param, value);
+			if (param == Parameter::Shimmer && !Reverb.IsShimmerPrepared((int)scaled))
+				return Reverb.ApplyParameter(param, scaled); // ignored and logged, the stored value stays as it was
+
 			parameters[param] = value;
-			auto scaled = GetScaledParameter(param);
-			Reverb.SetParameter(param, scaled);
 
 			if (param == Parameter::InputMode)
 			{
 				inputMode = (InputMode)(int)scaled;
-				Serial.print("Input mode: ");
-				Serial.println((int)inputMode);
+				Z4_LOG_INFO("Input mode: %d", (int)inputMode);
 			}
 			if (param == Parameter::Active)
 			{
@@ -96,38 +269,43 @@ namespace Z4
 				inGain = DB2gain(scaled);
 			else if (param == Parameter::OutGain)
 				outGain = DB2gain(scaled);
+
+			return Reverb.ApplyParameter(param, scaled);
 		}
 
-		void Process(float** inputs, float** outputs, int bufferSize)
+		void ProcessBlock(Sample** blockInputs, Sample** blockOutputs, int offset, int bufferSize)
 		{
+			Sample* inputs[2] = {&blockInputs[0][offset], &blockInputs[1][offset]};
+			Sample* outputs[2] = {&blockOutputs[0][offset], &blockOutputs[1][offset]};
+
 			// inGain applied to ADC programmable amplifier
 			//Gain(inputs[0], inGain, bufferSize);
 			//Gain(inputs[1], inGain, bufferSize);
 			
-			auto a = Buffers::Request();
-			auto b = Buffers::Request();
-			float* tempInputs[2] = {a.Ptr, b.Ptr};
+			PoolBuffer a;
+			PoolBuffer b;
+			Sample* tempInputs[2] = {a.As<Sample>(), b.As<Sample>()};
 
 			if (inputMode == InputMode::Left)
 			{
-				Copy(tempInputs[0], inputs[0], bufferSize);
-				Copy(tempInputs[1], inputs[0], bufferSize);
+				ToEngine(tempInputs[0], inputs[0], bufferSize);
+				ToEngine(tempInputs[1], inputs[0], bufferSize);
 			}
 			else if (inputMode == InputMode::Right)
 			{
-				Copy(tempInputs[0], inputs[1], bufferSize);
-				Copy(tempInputs[1], inputs[1], bufferSize);
+				ToEngine(tempInputs[0], inputs[1], bufferSize);
+				ToEngine(tempInputs[1], inputs[1], bufferSize);
 			}
 			else
 			{
-				Copy(tempInputs[0], inputs[0], bufferSize);
-				Copy(tempInputs[1], inputs[1], bufferSize);
+				ToEngine(tempInputs[0], inputs[0], bufferSize);
+				ToEngine(tempInputs[1], inputs[1], bufferSize);
 			}
 
 			Reverb.Process(tempInputs, outputs, bufferSize);
 			
-			Gain(outputs[0], outGain, bufferSize);
-			Gain(outputs[1], outGain, bufferSize);
+			FromEngine(outputs[0], outGain, bufferSize);
+			FromEngine(outputs[1], outGain, bufferSize);
 
 			// We still need to do all the processing above even if effect is not active
 			// otherwise we get frozen buffers and stale data when we turn it back on
@@ -137,12 +315,46 @@ namespace Z4
 				Copy(outputs[1], inputs[1], bufferSize);
 			}
 		}
-		
-	private:
-		double P(int para, int maxVal=1023)
+
+		struct StateHeader
 		{
-			auto idx = (int)para;
-			return idx >= 0 && idx < Parameter::COUNT ? (parameters[idx] / (double)maxVal) : 0.0;
+			uint32_t Magic = 0x5453345A; // "Z4ST"
+			uint32_t Version = 3;
+			uint32_t SampleSize = sizeof(Sample);
+			uint32_t BufferSize = BUFFER_SIZE;
+			int32_t Samplerate = 0;
+			uint64_t Size = 0;
+		};
+
+		void WriteState(StateWriter& writer)
+		{
+			StateWriter counter;
+			WriteBody(counter);
+
+			StateHeader header;
+			header.Samplerate = samplerate;
+			header.Size = sizeof(StateHeader) + counter.GetSize();
+			writer.Write(header);
+			WriteBody(writer);
+		}
+
+		void WriteBody(StateWriter& writer)
+		{
+			writer.Write(parameters);
+			writer.Write(inputMode);
+			writer.Write(inGain);
+			writer.Write(outGain);
+			writer.Write(active);
+			writer.Write(samplePosition);
+			Reverb.SaveState(writer);
+		}
+
+		double P(uint16_t value, int maxVal=1023)
+		{
+			return value / (double)maxVal;
 		}
 	};
+
+	typedef BasicController<Z4Rev> Controller;
+	typedef BasicController<Z4RevFixed> ControllerFixed;
 }
@@ -0,0 +1,88 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <type_traits>
+
+namespace Z4
+{
+    // Sequential writer for engine snapshots. Without a buffer it only counts, which is how the
+    // snapshot size is found. Blocks are copied as raw bytes, so a snapshot is only good for the build
+    // that wrote it, see the header written by the controller.
+    class StateWriter
+    {
+        uint8_t* Data;
+        size_t Capacity;
+        size_t Position;
+        bool Overflow;
+
+    public:
+        StateWriter(uint8_t* data = nullptr, size_t capacity = 0)
+        {
+            Data = data;
+            Capacity = capacity;
+            Position = 0;
+            Overflow = false;
+        }
+
+        template<typename T>
+        inline void Write(const T& value)
+        {
+            static_assert(std::is_trivially_copyable<T>::value, "only plain state can be snapshotted");
+            WriteBytes(&value, sizeof(T));
+        }
+
+        inline void WriteBytes(const void* value, size_t size)
+        {
+            if (Data != nullptr)
+            {
+                if (Position + size > Capacity)
+                    Overflow = true;
+                else
+                    memcpy(&Data[Position], value, size);
+            }
+            Position += size;
+        }
+
+        inline size_t GetSize() { return Position; }
+        inline bool IsOk() { return !Overflow; }
+    };
+
+    class StateReader
+    {
+        const uint8_t* Data;
+        size_t Size;
+        size_t Position;
+        bool Underflow;
+
+    public:
+        StateReader(const uint8_t* data, size_t size)
+        {
+            Data = data;
+            Size = size;
+            Position = 0;
+            Underflow = false;
+        }
+
+        template<typename T>
+        inline void Read(T& value)
+        {
+            static_assert(std::is_trivially_copyable<T>::value, "only plain state can be snapshotted");
+            ReadBytes(&value, sizeof(T));
+        }
+
+        inline void ReadBytes(void* value, size_t size)
+        {
+            if (Underflow || Position + size > Size)
+            {
+                Underflow = true;
+                return;
+            }
+            memcpy(value, &Data[Position], size);
+            Position += size;
+        }
+
+        inline size_t Remaining() { return Size - Position; }
+        inline bool IsOk() { return !Underflow; }
+    };
+}
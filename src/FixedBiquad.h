@@ -0,0 +1,102 @@
+#pragma once
+#include <math.h>
+#include <stdint.h>
+#include "blocks/Biquad.h"
+#include "FixedPoint.h"
+
+using namespace Polygons;
+
+namespace Z4
+{
+    // Q31 counterpart of Polygons::Biquad for the fixed point engine, same filter types and interface.
+    // Coefficients are designed in double on Update() (RBJ cookbook, Butterworth Q for the 12dB types) and
+    // stored as Q30, the filter runs direct form I with a 64 bit accumulator. The rounding error is fed
+    // back into the next sample, which keeps low cutoffs from raising the noise floor.
+    class FixedBiquad
+    {
+        static const int CoeffBits = 30;
+
+        Biquad::FilterType Type;
+        int Samplerate;
+        int32_t b0, b1, b2, a1, a2;
+        int32_t x1, x2, y1, y2;
+        int64_t error;
+
+    public:
+        double Frequency;
+
+        FixedBiquad(Biquad::FilterType type, int samplerate)
+        {
+            Type = type;
+            Samplerate = samplerate;
+            Frequency = 1000;
+            b0 = 1 << CoeffBits;
+            b1 = b2 = a1 = a2 = 0;
+            x1 = x2 = y1 = y2 = 0;
+            error = 0;
+        }
+
+        void Update()
+        {
+            double fc = fmin(Frequency, Samplerate * 0.49);
+            double w0 = 2 * M_PI * fc / Samplerate;
+            double nb0, nb1, nb2, na1, na2;
+
+            if (Type == Biquad::FilterType::LowPass6db || Type == Biquad::FilterType::HighPass6db)
+            {
+                double k = tan(w0 * 0.5);
+                double norm = 1 / (1 + k);
+                nb0 = Type == Biquad::FilterType::LowPass6db ? k * norm : norm;
+                nb1 = Type == Biquad::FilterType::LowPass6db ? nb0 : -nb0;
+                nb2 = 0;
+                na1 = (k - 1) * norm;
+                na2 = 0;
+            }
+            else
+            {
+                double cosw = cos(w0);
+                double alpha = sin(w0) / (2 * 0.70710678);
+                double norm = 1 / (1 + alpha);
+                bool lowpass = Type != Biquad::FilterType::HighPass;
+                nb0 = (lowpass ? (1 - cosw) : (1 + cosw)) * 0.5 * norm;
+                nb1 = (lowpass ? 2 : -2) * nb0;
+                nb2 = nb0;
+                na1 = -2 * cosw * norm;
+                na2 = (1 - alpha) * norm;
+            }
+
+            b0 = ToCoeff(nb0);
+            b1 = ToCoeff(nb1);
+            b2 = ToCoeff(nb2);
+            a1 = ToCoeff(na1);
+            a2 = ToCoeff(na2);
+        }
+
+        void Process(int32_t* input, int32_t* output, int len)
+        {
+            for (int i = 0; i < len; i++)
+            {
+                int32_t x = input[i];
+                int64_t acc = error + (int64_t)b0 * x + (int64_t)b1 * x1 + (int64_t)b2 * x2
+                    - (int64_t)a1 * y1 - (int64_t)a2 * y2;
+
+                int32_t y = Fixed::Saturate(acc >> CoeffBits);
+                error = acc - ((int64_t)y << CoeffBits);
+                if (error < 0 || error >= (1LL << CoeffBits))
+                    error = 0; // saturated, don't carry the overshoot
+
+                x2 = x1;
+                x1 = x;
+                y2 = y1;
+                y1 = y;
+                output[i] = y;
+            }
+        }
+
+    private:
+        static inline int32_t ToCoeff(double value)
+        {
+            return (int32_t)fmax(fmin(round(value * (1 << CoeffBits)), INT32_MAX), INT32_MIN);
+        }
+    };
+}
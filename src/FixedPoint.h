@@ -0,0 +1,212 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include "Utils.h"
+
+// Fixed point helpers for the Q31 engine (Z4RevFixed).
+// Signals are Q31, delay memory is Q15, gains are Q15 when they are below one and Q16.16 otherwise.
+// On Cortex-M4/M7 these map onto the DSP extension (QADD, QSUB, SMULWB, SMUAD), elsewhere onto plain C.
+
+namespace Z4
+{
+    namespace Fixed
+    {
+        // Engine signals run 12dB below the codec so the tank has room to swing above full scale
+        const int HeadroomBits = 2;
+
+        inline int32_t Saturate(int64_t value)
+        {
+            if (value > INT32_MAX) return INT32_MAX;
+            if (value < INT32_MIN) return INT32_MIN;
+            return (int32_t)value;
+        }
+
+        inline int32_t QAdd(int32_t a, int32_t b)
+        {
+#if defined(__ARM_FEATURE_DSP)
+            int32_t result;
+            asm("qadd %0, %1, %2" : "=r" (result) : "r" (a), "r" (b));
+            return result;
+#else
+            return Saturate((int64_t)a + b);
+#endif
+        }
+
+        inline int32_t QSub(int32_t a, int32_t b)
+        {
+#if defined(__ARM_FEATURE_DSP)
+            int32_t result;
+            asm("qsub %0, %1, %2" : "=r" (result) : "r" (a), "r" (b));
+            return result;
+#else
+            return Saturate((int64_t)a - b);
+#endif
+        }
+
+        // Q31 * Q15 -> Q31
+        inline int32_t MulQ15(int32_t a, int16_t b)
+        {
+#if defined(__ARM_FEATURE_DSP)
+            int32_t result;
+            asm("smulwb %0, %1, %2" : "=r" (result) : "r" (a), "r" (b));
+            return QAdd(result, result);
+#else
+            return (int32_t)(((int64_t)a * b) >> 15);
+#endif
+        }
+
+        // Q31 * Q16.16 -> Q31, for gains that may be above one
+        inline int32_t MulQ16(int32_t a, int32_t b)
+        {
+            return Saturate(((int64_t)a * b) >> 16);
+        }
+
+        // Q31 -> Q15 with rounding, the saturating add keeps the rounding from wrapping at full scale
+        inline int16_t ToQ15(int32_t a)
+        {
+            return (int16_t)(QAdd(a, 0x8000) >> 16);
+        }
+
+        // Two adjacent 16 bit samples times two packed 16 bit weights, summed. The weights must not
+        // both be -32768, then the result fits 32 bits and needs no saturation
+        inline int32_t Dot2(const int16_t* x, uint32_t weights)
+        {
+            uint32_t packed;
+            memcpy(&packed, x, sizeof(packed)); // single unaligned load
+#if defined(__ARM_FEATURE_DSP)
+            int32_t result;
+            asm("smuad %0, %1, %2" : "=r" (result) : "r" (packed), "r" (weights));
+            return result;
+#else
+            int16_t w0 = (int16_t)(weights & 0xFFFF);
+            int16_t w1 = (int16_t)(weights >> 16);
+            int16_t x0 = (int16_t)(packed & 0xFFFF);
+            int16_t x1 = (int16_t)(packed >> 16);
+            return x0 * w0 + x1 * w1;
+#endif
+        }
+
+        inline int16_t GainToQ15(float gain)
+        {
+            float g = gain * 32768.0f;
+            if (g > 32767) return 32767;
+            if (g < -32768) return -32768;
+            return (int16_t)g;
+        }
+
+        inline int32_t GainToQ16(float gain)
+        {
+            return (int32_t)(gain * 65536.0f);
+        }
+
+        inline int32_t ToQ31(float value)
+        {
+            return Saturate((int64_t)(value * 2147483648.0f));
+        }
+
+        inline float ToFloat(int32_t value)
+        {
+            return value * (1.0f / 2147483648.0f);
+        }
+    }
+}
+
+// Q31 overloads of the Polygons buffer helpers, so the engine code reads the same for both sample types
+namespace Polygons
+{
+    inline void ZeroBuffer(int32_t* buffer, int len)
+    {
+        memset(buffer, 0, len * sizeof(int32_t));
+    }
+
+    inline void Copy(int32_t* dest, const int32_t* source, int len)
+    {
+        memcpy(dest, source, len * sizeof(int32_t));
+    }
+
+    inline void Gain(int32_t* buffer, float gain, int len)
+    {
+        if (gain < 1.0f && gain > -1.0f)
+        {
+            int16_t g = Z4::Fixed::GainToQ15(gain);
+            for (int i = 0; i < len; i++)
+                buffer[i] = Z4::Fixed::MulQ15(buffer[i], g);
+        }
+        else
+        {
+            int32_t g = Z4::Fixed::GainToQ16(gain);
+            for (int i = 0; i < len; i++)
+                buffer[i] = Z4::Fixed::MulQ16(buffer[i], g);
+        }
+    }
+
+    inline void Mix(int32_t* target, const int32_t* source, float gain, int len)
+    {
+        if (gain == 1.0f)
+        {
+            for (int i = 0; i < len; i++)
+                target[i] = Z4::Fixed::QAdd(target[i], source[i]);
+        }
+        else if (gain < 1.0f && gain > -1.0f)
+        {
+            int16_t g = Z4::Fixed::GainToQ15(gain);
+            for (int i = 0; i < len; i++)
+                target[i] = Z4::Fixed::QAdd(target[i], Z4::Fixed::MulQ15(source[i], g));
+        }
+        else
+        {
+            int32_t g = Z4::Fixed::GainToQ16(gain);
+            for (int i = 0; i < len; i++)
+                target[i] = Z4::Fixed::QAdd(target[i], Z4::Fixed::MulQ16(source[i], g));
+        }
+    }
+}
+
+namespace Z4
+{
+    // Conversions between the engine's sample type and float, for the blocks that only exist in float (pitch shifters)
+    inline void ToFloat(float* dest, float* source, int len)
+    {
+        Copy(dest, source, len);
+    }
+
+    inline void ToFloat(float* dest, const int32_t* source, int len)
+    {
+        for (int i = 0; i < len; i++)
+            dest[i] = Fixed::ToFloat(source[i]);
+    }
+
+    inline void MixFloat(float* target, float* source, float gain, int len)
+    {
+        Mix(target, source, gain, len);
+    }
+
+    inline void MixFloat(int32_t* target, const float* source, float gain, int len)
+    {
+        for (int i = 0; i < len; i++)
+            target[i] = Fixed::QAdd(target[i], Fixed::ToQ31(source[i] * gain));
+    }
+
+    // Codec format to engine format and back, with an output gain. Float runs at unity,
+    // Q31 gives up HeadroomBits at the input and takes them back at the output
+    inline void ToEngine(float* dest, float* source, int len)
+    {
+        Copy(dest, source, len);
+    }
+
+    inline void ToEngine(int32_t* dest, const int32_t* source, int len)
+    {
+        for (int i = 0; i < len; i++)
+            dest[i] = source[i] >> Fixed::HeadroomBits;
+    }
+
+    inline void FromEngine(float* buffer, float gain, int len)
+    {
+        Gain(buffer, gain, len);
+    }
+
+    inline void FromEngine(int32_t* buffer, float gain, int len)
+    {
+        Gain(buffer, gain * (1 << Fixed::HeadroomBits), len);
+    }
+}
@@ -1,6 +1,6 @@
 #pragma once
 #include <math.h>
-#include <stdlib.h>
+#include <stdint.h>
 #include "Utils.h"
 
 using namespace Polygons;
@@ -85,10 +85,21 @@ namespace Z4
         float Buffer[N];
         Grain Grains[GrainCount];
         int Samplerate;
+        float PitchShift;
+        uint32_t Seed;
         int K;
+        int WarmupRemaining;
 
     public:
         inline GranularPitchShift(int samplerate, float pitchShift)
+        {
+            this->Samplerate = samplerate;
+            this->PitchShift = pitchShift;
+            this->Seed = 0x9E3779B9u ^ (uint32_t)(pitchShift * 1000);
+            Reset();
+        }
+
+        inline void Reset()
         {
             ZeroBuffer(Buffer, N);
 
@@ -96,15 +107,39 @@ namespace Z4
             {
                 Grains[i].start = GrainSize/GrainCount*i;
                 Grains[i].length = GrainSize;
-                Grains[i].speed = pitchShift;
+                Grains[i].speed = PitchShift;
                 Grains[i].pos = 0;
+                Grains[i].active = true;
             }
 
             K = 0;
-            this->Samplerate = samplerate;
+            // The buffer is written GrainSize ahead of the read head, and the first generation of grains
+            // reads from before anything was written. Output is silent until both have passed.
+            WarmupRemaining = 2 * GrainSize;
+        }
+
+        inline bool IsWarm()
+        {
+            return WarmupRemaining <= 0;
+        }
+
+        // Average delay between the input and the shifted output. Reads trail the writes by GrainSize,
+        // and drift by the pitch shift over a grain, which is 1.5x GrainSize long on average
+        inline int GetLatency()
+        {
+            return GrainSize - (int)((PitchShift - 1) * 1.5f * GrainSize / (2 * PitchShift));
         }
 
 
+        // xorshift32, rand() is not real-time safe as it may take a lock
+        inline float Random()
+        {
+            Seed ^= Seed << 13;
+            Seed ^= Seed >> 17;
+            Seed ^= Seed << 5;
+            return Seed * (1.0f / 4294967296.0f);
+        }
+
         inline void ResetCounter()
         {
             // used to periodically reduce the K value, which otherwise grows infinitely.
@@ -133,9 +168,9 @@ namespace Z4
                 int samples_processed = g->Process(bufSize, Buffer, N, &output[0]);
                 if (!g->active)
                 {
-                    g->start = K + samples_processed + (rand()/(float)RAND_MAX) * 300;
+                    g->start = K + samples_processed + Random() * 300;
                     g->pos = g->start;
-                    g->length = (rand()/(float)RAND_MAX + 1) * GrainSize;
+                    g->length = (Random() + 1) * GrainSize;
                     g->active = true;
                     if (samples_processed < bufSize)
                         g->Process(bufSize - samples_processed, Buffer, N, &output[samples_processed]);
@@ -144,6 +179,8 @@ namespace Z4
 
             Gain(output, 1.0 / sqrtf(GrainCount/2.0), bufSize);
             K += bufSize;
+            if (WarmupRemaining > 0)
+                WarmupRemaining -= bufSize;
 
             if (K > 1000000)
                 ResetCounter();
@@ -0,0 +1,226 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#ifndef Z4_HOST
+#include <Arduino.h>
+#endif
+
+// Real-time safe logging. Z4_LOG_xxx only copies the format pointer and up to two numeric arguments
+// into a fixed ring, formatting and printing happens later when loop() calls Z4::Log::Drain().
+// The format must be a string literal, arguments are numbers formatted by their conversion (%d, %.2f, ...).
+// Arguments are stored as double, so length modifiers (%ld, %lld, %zu, ...) are rejected at compile time.
+//
+// Messages above Z4_LOG_LEVEL compile out entirely. When the ring is full, messages are dropped and counted.
+// Off-device (Z4_HOST), the default sink writes to stdout; tests can install their own with Log::SetSink.
+
+#define Z4_LOG_LEVEL_NONE 0
+#define Z4_LOG_LEVEL_ERROR 1
+#define Z4_LOG_LEVEL_WARN 2
+#define Z4_LOG_LEVEL_INFO 3
+#define Z4_LOG_LEVEL_DEBUG 4
+
+#ifndef Z4_LOG_LEVEL
+#define Z4_LOG_LEVEL Z4_LOG_LEVEL_INFO
+#endif
+
+#define Z4_LOG_PUSH(level, format, ...) \
+    do \
+    { \
+        static_assert(!Z4::Log::HasLengthModifier(format), "Z4 log formats can't have length modifiers, cast the argument to int or double"); \
+        Z4::Log::Push(level, format, ##__VA_ARGS__); \
+    } while (0)
+
+#if Z4_LOG_LEVEL >= Z4_LOG_LEVEL_ERROR
+#define Z4_LOG_ERROR(...) Z4_LOG_PUSH(Z4_LOG_LEVEL_ERROR, __VA_ARGS__)
+#else
+#define Z4_LOG_ERROR(...) do {} while (0)
+#endif
+
+#if Z4_LOG_LEVEL >= Z4_LOG_LEVEL_WARN
+#define Z4_LOG_WARN(...) Z4_LOG_PUSH(Z4_LOG_LEVEL_WARN, __VA_ARGS__)
+#else
+#define Z4_LOG_WARN(...) do {} while (0)
+#endif
+
+#if Z4_LOG_LEVEL >= Z4_LOG_LEVEL_INFO
+#define Z4_LOG_INFO(...) Z4_LOG_PUSH(Z4_LOG_LEVEL_INFO, __VA_ARGS__)
+#else
+#define Z4_LOG_INFO(...) do {} while (0)
+#endif
+
+#if Z4_LOG_LEVEL >= Z4_LOG_LEVEL_DEBUG
+#define Z4_LOG_DEBUG(...) Z4_LOG_PUSH(Z4_LOG_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define Z4_LOG_DEBUG(...) do {} while (0)
+#endif
+
+namespace Z4
+{
+    namespace Log
+    {
+        const int RingSize = 32; // must be a power of two
+        const int MaxArgs = 2;
+        const int MaxLineLength = 128;
+
+        typedef void (*SinkFunc)(int level, const char* line);
+
+        constexpr bool IsOneOf(char c, const char* set)
+        {
+            return *set != 0 && (*set == c || IsOneOf(c, set + 1));
+        }
+
+        // Checks the conversion starting after a '%', skipping flags, width and precision
+        constexpr bool IsLengthModifier(const char* f)
+        {
+            return IsOneOf(*f, "-+ #0123456789.*") ? IsLengthModifier(f + 1) : IsOneOf(*f, "hlLjztq");
+        }
+
+        // Used by the Z4_LOG_xxx macros, see Z4_LOG_PUSH
+        constexpr bool HasLengthModifier(const char* format)
+        {
+            return *format == 0 ? false
+                : *format != '%' ? HasLengthModifier(format + 1)
+                : format[1] == '%' ? HasLengthModifier(format + 2)
+                : IsLengthModifier(format + 1) || HasLengthModifier(format + 1);
+        }
+
+        struct Record
+        {
+            const char* Format;
+            double Args[MaxArgs];
+            uint8_t Level;
+            uint8_t ArgCount;
+        };
+
+        // Multiple producers (control thread and audio interrupt) reserve slots with a CAS on WriteIndex,
+        // the single consumer is Drain(). A slot is only read once its Ready flag is set.
+        inline Record* Slots() { static Record slots[RingSize]; return slots; }
+        inline std::atomic<uint8_t>* Ready() { static std::atomic<uint8_t> ready[RingSize]; return ready; }
+        inline std::atomic<uint32_t>& WriteIndex() { static std::atomic<uint32_t> index(0); return index; }
+        inline std::atomic<uint32_t>& ReadIndex() { static std::atomic<uint32_t> index(0); return index; }
+        inline std::atomic<uint32_t>& Dropped() { static std::atomic<uint32_t> dropped(0); return dropped; }
+
+        inline void DefaultSink(int, const char* line)
+        {
+#ifdef Z4_HOST
+            printf("%s\n", line);
+#else
+            Serial.println(line);
+#endif
+        }
+
+        inline SinkFunc& Sink() { static SinkFunc sink = DefaultSink; return sink; }
+        inline void SetSink(SinkFunc sink) { Sink() = sink; }
+
+        inline uint32_t GetDroppedCount()
+        {
+            return Dropped().load(std::memory_order_relaxed);
+        }
+
+        inline void PushRecord(int level, const char* format, int argCount, double a, double b)
+        {
+            auto& writeIndex = WriteIndex();
+            uint32_t w = writeIndex.load(std::memory_order_relaxed);
+            do
+            {
+                if (w - ReadIndex().load(std::memory_order_acquire) >= (uint32_t)RingSize)
+                {
+                    Dropped().fetch_add(1, std::memory_order_relaxed);
+                    return;
+                }
+            } while (!writeIndex.compare_exchange_weak(w, w + 1, std::memory_order_acq_rel, std::memory_order_relaxed));
+
+            int slot = w & (RingSize - 1);
+            Record* r = &Slots()[slot];
+            r->Format = format;
+            r->Level = (uint8_t)level;
+            r->ArgCount = (uint8_t)argCount;
+            r->Args[0] = a;
+            r->Args[1] = b;
+            Ready()[slot].store(1, std::memory_order_release);
+        }
+
+        inline void Push(int level, const char* format) { PushRecord(level, format, 0, 0, 0); }
+        inline void Push(int level, const char* format, double a) { PushRecord(level, format, 1, a, 0); }
+        inline void Push(int level, const char* format, double a, double b) { PushRecord(level, format, 2, a, b); }
+
+        // Expands the format, each conversion consumes the next argument
+        inline void Format(const Record* r, char* dest, int size)
+        {
+            int argIdx = 0;
+            int len = 0;
+            const char* f = r->Format;
+            while (*f && len < size - 1)
+            {
+                if (*f != '%' || f[1] == '%')
+                {
+                    dest[len++] = *f;
+                    f += (*f == '%') ? 2 : 1;
+                    continue;
+                }
+
+                char spec[16];
+                int specLen = 0;
+                while (*f && specLen < (int)sizeof(spec) - 1)
+                {
+                    spec[specLen++] = *f;
+                    if (strchr("diuxXcfFeEgGsp", *f) && specLen > 1)
+                        break;
+                    f++;
+                }
+                if (*f) f++;
+                spec[specLen] = 0;
+
+                double arg = argIdx < r->ArgCount ? r->Args[argIdx] : 0;
+                argIdx++;
+                char conv = spec[specLen - 1];
+                int written;
+                if (strchr("fFeEgG", conv))
+                    written = snprintf(&dest[len], size - len, spec, arg);
+                else if (strchr("dic", conv))
+                    written = snprintf(&dest[len], size - len, spec, (int)(int64_t)arg);
+                else if (strchr("uxX", conv))
+                    written = snprintf(&dest[len], size - len, spec, (unsigned)(int64_t)arg);
+                else
+                    written = snprintf(&dest[len], size - len, "?"); // strings and pointers can't be deferred
+                if (written > 0)
+                    len += written < size - len ? written : size - len - 1;
+            }
+            dest[len] = 0;
+        }
+
+        // Call from loop(), never from the audio callback
+        inline void Drain()
+        {
+            static uint32_t reportedDropped = 0;
+            char line[MaxLineLength];
+            auto& readIndex = ReadIndex();
+            uint32_t r = readIndex.load(std::memory_order_relaxed);
+
+            while (r != WriteIndex().load(std::memory_order_acquire))
+            {
+                int slot = r & (RingSize - 1);
+                if (!Ready()[slot].load(std::memory_order_acquire))
+                    break; // reserved but not yet written, pick it up next time
+
+                Record* rec = &Slots()[slot];
+                Format(rec, line, sizeof(line));
+                int level = rec->Level;
+                Ready()[slot].store(0, std::memory_order_relaxed);
+                readIndex.store(++r, std::memory_order_release);
+                Sink()(level, line);
+            }
+
+            uint32_t dropped = GetDroppedCount();
+            if (dropped != reportedDropped)
+            {
+                snprintf(line, sizeof(line), "Log: %u messages dropped", (unsigned)(dropped - reportedDropped));
+                reportedDropped = dropped;
+                Sink()(Z4_LOG_LEVEL_WARN, line);
+            }
+        }
+    }
+}
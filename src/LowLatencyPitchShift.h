@@ -0,0 +1,205 @@
+#pragma once
+#include <math.h>
+#include <stdint.h>
+#include "Utils.h"
+#include "ModulatedLine.h"
+
+using namespace Polygons;
+
+namespace Z4
+{
+    // Short-grain pitch shifter for the shimmer, an alternative to GranularPitchShift.
+    //
+    // Grains are Hann windowed and start every half grain, so with a constant length exactly two overlap
+    // and their windows sum to one. Each grain starts reading just far enough behind the write head that
+    // it never overtakes it, which is what sets the latency.
+    //
+    // The grain length adapts to the material: the period of the input is estimated from its zero
+    // crossings, and the hop between grains is chosen so that the read positions of two overlapping grains
+    // are a whole number of periods apart. Overlapping grains then add up in phase (pitch synchronous),
+    // which lets the grains be much shorter than in GranularPitchShift. Lengths stay between MinGrain and MaxGrain.
+    template<int N>
+    class LowLatencyPitchShift
+    {
+        const static int MinGrain = 256;
+        const static int MaxGrain = 2048;
+        const static int MaxVoices = 3;
+        const static int PeriodWindow = 1024;
+
+        struct Voice
+        {
+            float ReadPos;
+            int Age;
+            int Length;
+            bool Active;
+        };
+
+        float Buffer[N];
+        Voice Voices[MaxVoices];
+        float PitchShift;
+        int WritePos;
+        int HopCounter;
+        int GrainLength;
+        float Period;
+        int Crossings;
+        int CrossingSamples;
+        float LastSample;
+        int WarmupRemaining;
+
+    public:
+        inline LowLatencyPitchShift(float pitchShift)
+        {
+            static_assert(N >= 2 * MaxGrain, "buffer must hold the longest grain plus its read-ahead");
+            LfoTable::Init();
+            this->PitchShift = pitchShift;
+            Reset();
+        }
+
+        inline void Reset()
+        {
+            ZeroBuffer(Buffer, N);
+            for (int i = 0; i < MaxVoices; i++)
+                Voices[i].Active = false;
+
+            WritePos = 0;
+            HopCounter = 0;
+            GrainLength = MaxGrain / 2;
+            Period = 0;
+            Crossings = 0;
+            CrossingSamples = 0;
+            LastSample = 0;
+            WarmupRemaining = 2 * MaxGrain;
+        }
+
+        inline bool IsWarm()
+        {
+            return WarmupRemaining <= 0;
+        }
+
+        // Average delay between the input and the pitch shifted output, for the current grain length
+        inline int GetLatency()
+        {
+            return GetStartDelay(GrainLength) - (int)((PitchShift - 1) * GrainLength / 2);
+        }
+
+        inline void Process(float* input, float* output, int bufSize)
+        {
+            EstimatePeriod(input, bufSize);
+
+            for (int i = 0; i < bufSize; i++)
+            {
+                Buffer[WritePos] = input[i];
+
+                if (HopCounter <= 0)
+                {
+                    StartGrain();
+                    HopCounter = GrainLength / 2;
+                }
+                HopCounter--;
+
+                float sum = 0;
+                float windowSum = 0;
+                for (int v = 0; v < MaxVoices; v++)
+                {
+                    Voice* voice = &Voices[v];
+                    if (!voice->Active)
+                        continue;
+
+                    // Hann window, sin^2 taken from the shared LFO table
+                    float s = LfoTable::Lookup(voice->Age * 0.5f / voice->Length);
+                    float window = s * s;
+                    sum += Read(voice->ReadPos) * window;
+                    windowSum += window;
+
+                    voice->ReadPos += PitchShift;
+                    if (voice->ReadPos >= N)
+                        voice->ReadPos -= N;
+                    voice->Age++;
+                    if (voice->Age >= voice->Length)
+                        voice->Active = false;
+                }
+
+                // the windows only sum to one when consecutive grains have the same length
+                output[i] = sum / (windowSum > 0.5f ? windowSum : 0.5f);
+
+                WritePos++;
+                if (WritePos >= N)
+                    WritePos = 0;
+            }
+
+            if (WarmupRemaining > 0)
+                WarmupRemaining -= bufSize;
+        }
+
+    private:
+        // How far behind the write head a grain of this length has to start
+        inline int GetStartDelay(int length)
+        {
+            return PitchShift > 1 ? (int)((PitchShift - 1) * length) + 2 : 2;
+        }
+
+        inline float Read(float pos)
+        {
+            int a = (int)pos;
+            int b = a + 1 < N ? a + 1 : 0;
+            float frac = pos - a;
+            return Buffer[a] + (Buffer[b] - Buffer[a]) * frac;
+        }
+
+        inline void StartGrain()
+        {
+            // Two grains started a hop apart read (PitchShift - 1) * hop samples apart
+            int length = MaxGrain;
+            if (Period > 0)
+            {
+                // rounded up, the hop must not fall below half of MinGrain
+                float unit = Period / fabsf(PitchShift - 1);
+                int units = (int)ceilf(MinGrain / 2 / unit);
+                if (units < 1)
+                    units = 1;
+                length = 2 * (int)(units * unit + 0.5f);
+                if (length > MaxGrain)
+                    length = MaxGrain;
+            }
+            GrainLength = length;
+
+            for (int v = 0; v < MaxVoices; v++)
+            {
+                Voice* voice = &Voices[v];
+                if (voice->Active)
+                    continue;
+
+                int start = WritePos - GetStartDelay(length);
+                voice->ReadPos = (float)(start < 0 ? start + N : start);
+                voice->Age = 0;
+                voice->Length = length;
+                voice->Active = true;
+                return;
+            }
+        }
+
+        // Counts positive going zero crossings, once a window is full the period estimate is updated
+        inline void EstimatePeriod(float* input, int bufSize)
+        {
+            for (int i = 0; i < bufSize; i++)
+            {
+                if (LastSample < 0 && input[i] >= 0)
+                    Crossings++;
+                LastSample = input[i];
+            }
+
+            CrossingSamples += bufSize;
+            if (CrossingSamples < PeriodWindow)
+                return;
+
+            // silence keeps the last estimate
+            if (Crossings > 0)
+            {
+                float period = CrossingSamples / (float)Crossings;
+                Period = Period == 0 ? period : Period * 0.7f + period * 0.3f;
+            }
+            Crossings = 0;
+            CrossingSamples = 0;
+        }
+    };
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include <stdint.h>
+#include "FixedPoint.h"
+
+namespace Z4
+{
+    // Orthogonal mixing of the tank lines, in place, for the FDN tank (see TankMode).
+    // Orthogonal means lossless, so the decay is still set by the feedback gain alone.
+    namespace MixingMatrix
+    {
+        // 4x4 Householder reflection, I - 1/2 * ones. Every line gets +-1/2 of every other, which mixes
+        // as thoroughly as a 4x4 Hadamard, but costs one sum and a subtraction per line rather than two
+        // stages of butterflies
+        inline void Householder4(float* a, float* b, float* c, float* d, int bufSize)
+        {
+            for (int i = 0; i < bufSize; i++)
+            {
+                float half = (a[i] + b[i] + c[i] + d[i]) * 0.5f;
+                a[i] -= half;
+                b[i] -= half;
+                c[i] -= half;
+                d[i] -= half;
+            }
+        }
+
+        inline void Householder4(int32_t* a, int32_t* b, int32_t* c, int32_t* d, int bufSize)
+        {
+            for (int i = 0; i < bufSize; i++)
+            {
+                // the sum can be twice full scale, so it's kept in 64 bits
+                int64_t half = ((int64_t)a[i] + b[i] + c[i] + d[i]) >> 1;
+                a[i] = Fixed::Saturate(a[i] - half);
+                b[i] = Fixed::Saturate(b[i] - half);
+                c[i] = Fixed::Saturate(c[i] - half);
+                d[i] = Fixed::Saturate(d[i] - half);
+            }
+        }
+
+        // 2x2 Hadamard, a 45 degree rotation. The 2x2 Householder is only a swap, which mixes nothing
+        inline void Hadamard2(float* a, float* b, int bufSize)
+        {
+            const float scale = 0.70710678f;
+            for (int i = 0; i < bufSize; i++)
+            {
+                float sum = (a[i] + b[i]) * scale;
+                b[i] = (a[i] - b[i]) * scale;
+                a[i] = sum;
+            }
+        }
+
+        inline void Hadamard2(int32_t* a, int32_t* b, int bufSize)
+        {
+            const int16_t scale = 23170; // 1/sqrt(2) in Q15
+            for (int i = 0; i < bufSize; i++)
+            {
+                int32_t x = Fixed::MulQ15(a[i], scale);
+                int32_t y = Fixed::MulQ15(b[i], scale);
+                a[i] = Fixed::QAdd(x, y);
+                b[i] = Fixed::QSub(x, y);
+            }
+        }
+    }
+}
@@ -0,0 +1,24 @@
+#pragma once
+#include "ModulatedLine.h"
+
+namespace Z4
+{
+    // A modulated allpass that runs either as a single mono line, or as two lanes (left/right)
+    // splitting the same delay memory. Both lanes share one modulator and one set of read positions,
+    // so the stereo block is the mono block with a second gather and allpass pass riding along.
+    // In stereo each lane only gets half of the delay memory, see GetCapacity().
+    template<int N, int BUFSIZE, typename T = float>
+    class ModulatedAllpassStereo : public ModulatedLine<N, BUFSIZE, 2, T>
+    {
+    public:
+        inline void Process(T* input, int bufSize)
+        {
+            this->ProcessAllpass(input, bufSize);
+        }
+
+        inline void Process(T* inputL, T* inputR, int bufSize)
+        {
+            this->ProcessAllpass(inputL, inputR, bufSize);
+        }
+    };
+}
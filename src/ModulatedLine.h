@@ -0,0 +1,358 @@
+#pragma once
+#include <math.h>
+#include <string.h>
+#include "Utils.h"
+#include "FixedPoint.h"
+
+using namespace Polygons;
+
+namespace Z4
+{
+    enum class InterpolationMode
+    {
+        None = 0,
+        Linear = 1,
+        Cubic = 2,
+    };
+
+    // One cycle of a sine, shared by every modulated line
+    class LfoTable
+    {
+    public:
+        static const int Size = 1024;
+
+        static inline float* Get()
+        {
+            static float table[Size + 1];
+            return table;
+        }
+
+        static inline void Init()
+        {
+            static bool initialised = false;
+            if (initialised)
+                return;
+
+            auto table = Get();
+            for (int i = 0; i <= Size; i++)
+                table[i] = sinf(2 * (float)M_PI * i / Size);
+            initialised = true;
+        }
+
+        // phase in cycles, 0...1
+        static inline float Lookup(float phase)
+        {
+            float pos = phase * Size;
+            int idx = (int)pos;
+            float frac = pos - idx;
+            auto table = Get();
+            return table[idx] + (table[idx + 1] - table[idx]) * frac;
+        }
+    };
+
+    // What a line stores for each sample type: float lines store float, Q31 lines store Q15 to halve the memory
+    template<typename T> struct LineSample;
+    template<> struct LineSample<float> { typedef float Type; };
+    template<> struct LineSample<int32_t> { typedef int16_t Type; };
+
+    // Block-based modulated delay line, the kernel behind the allpasses and delays of the reverb.
+    //
+    // The modulator runs at control rate: the delay is computed once per block from the shared LFO table,
+    // and ramped linearly across the block from where the previous block ended. All read positions of a
+    // block are computed first, then read in one gather pass, then the block is written. This needs the
+    // delay to be longer than the block, which is enforced, and keeps every loop free of dependencies.
+    //
+    // Up to LANES independent lines can share the memory and the modulator, see SetLanes().
+    // T is the signal type, float or Q31 (int32_t), see LineSample for what goes into the memory.
+    template<int N, int BUFSIZE, int LANES, typename T = float>
+    class ModulatedLine
+    {
+    protected:
+        typedef typename LineSample<T>::Type S;
+
+        // each lane mirrors its first samples past the end, so interpolation taps never need to wrap
+        static const int Guard = 3;
+
+        S Buffer[N + LANES * Guard];
+        T Output[LANES][BUFSIZE];
+        int Lanes;
+        int Size;
+        int Index;
+        float ModPhase;
+        float CurrentDelay;
+        bool Primed;
+
+    public:
+        int SampleDelay;
+        float Feedback;
+        float ModAmount;
+        float ModRate;
+        InterpolationMode Interpolation;
+
+        ModulatedLine()
+        {
+            LfoTable::Init();
+            memset(Buffer, 0, sizeof(Buffer));
+            memset(Output, 0, sizeof(Output));
+
+            Lanes = 1;
+            Size = N;
+            Index = 0;
+            ModPhase = 0;
+            CurrentDelay = 0;
+            Primed = false;
+
+            SampleDelay = 100;
+            Feedback = 0.5;
+            ModAmount = 0;
+            ModRate = 0;
+            Interpolation = InterpolationMode::Linear;
+        }
+
+        inline T* GetOutput(int lane = 0)
+        {
+            return Output[lane];
+        }
+
+        // Samples available to each lane
+        inline int GetCapacity()
+        {
+            return Size;
+        }
+
+        // Splits the memory between this many lanes. Changes the layout, so the line is cleared.
+        // Must be called from the audio thread, between blocks.
+        inline void SetLanes(int lanes)
+        {
+            if (lanes == Lanes || lanes < 1 || lanes > LANES)
+                return;
+
+            Lanes = lanes;
+            Size = N / lanes;
+            Index = 0;
+            memset(Buffer, 0, sizeof(Buffer));
+        }
+
+        inline void ProcessAllpass(T* input, int bufSize)
+        {
+            int base[BUFSIZE];
+            float frac[BUFSIZE];
+            ComputeTaps(bufSize, base, frac);
+            AllpassLane(0, input, base, frac, bufSize);
+            Advance(bufSize);
+        }
+
+        inline void ProcessAllpass(T* inputL, T* inputR, int bufSize)
+        {
+            int base[BUFSIZE];
+            float frac[BUFSIZE];
+            ComputeTaps(bufSize, base, frac);
+            AllpassLane(0, inputL, base, frac, bufSize);
+            AllpassLane(1, inputR, base, frac, bufSize);
+            Advance(bufSize);
+        }
+
+        inline void ProcessDelay(T* input, int bufSize)
+        {
+            int base[BUFSIZE];
+            float frac[BUFSIZE];
+            ComputeTaps(bufSize, base, frac);
+            Gather(GetLane(0), base, frac, Output[0], bufSize);
+            WriteInput(GetLane(0), input, bufSize);
+            Advance(bufSize);
+        }
+
+    protected:
+        inline S* GetLane(int lane)
+        {
+            return &Buffer[lane * (Size + Guard)];
+        }
+
+        // Advances the modulator by one block and fills in, for every sample, the index of the first
+        // of the four samples around the read position, and the fraction between the middle two
+        inline void ComputeTaps(int bufSize, int* base, float* frac)
+        {
+            ModPhase += ModRate * bufSize;
+            if (ModPhase >= 1)
+                ModPhase -= floorf(ModPhase);
+
+            float target = SampleDelay + ModAmount * LfoTable::Lookup(ModPhase);
+            target = ClipF(target, BUFSIZE + Guard, Size - Guard);
+            if (!Primed)
+            {
+                CurrentDelay = target;
+                Primed = true;
+            }
+
+            float delta = (target - CurrentDelay) / bufSize;
+            float start = Index - CurrentDelay;
+            for (int i = 0; i < bufSize; i++)
+            {
+                float pos = start + i - delta * (i + 1);
+                if (pos < 0) pos += Size;
+                if (pos >= Size) pos -= Size;
+
+                int ipos = (int)pos;
+                frac[i] = pos - ipos;
+                int b = ipos - 1;
+                base[i] = b < 0 ? b + Size : b;
+            }
+            // the rest of the arrays is never read, but is set so that every path leaves them initialised
+            for (int i = bufSize; i < BUFSIZE; i++)
+            {
+                base[i] = 0;
+                frac[i] = 0;
+            }
+            CurrentDelay = target;
+        }
+
+        inline void Gather(const float* data, const int* base, const float* frac, float* taps, int bufSize)
+        {
+            if (Interpolation == InterpolationMode::Cubic)
+            {
+                for (int i = 0; i < bufSize; i++)
+                {
+                    const float* x = &data[base[i]];
+                    float f = frac[i];
+                    float c1 = 0.5f * (x[2] - x[0]);
+                    float c2 = x[0] - 2.5f * x[1] + 2 * x[2] - 0.5f * x[3];
+                    float c3 = 0.5f * (x[3] - x[0]) + 1.5f * (x[1] - x[2]);
+                    taps[i] = ((c3 * f + c2) * f + c1) * f + x[1];
+                }
+            }
+            else if (Interpolation == InterpolationMode::Linear)
+            {
+                for (int i = 0; i < bufSize; i++)
+                {
+                    float x0 = data[base[i] + 1];
+                    float x1 = data[base[i] + 2];
+                    taps[i] = x0 + (x1 - x0) * frac[i];
+                }
+            }
+            else
+            {
+                for (int i = 0; i < bufSize; i++)
+                    taps[i] = data[base[i] + 1];
+            }
+        }
+
+        // Q15 memory to Q31 taps. The linear case is a single dual 16-bit MAC with Q14 weights
+        inline void Gather(const int16_t* data, const int* base, const float* frac, int32_t* taps, int bufSize)
+        {
+            if (Interpolation == InterpolationMode::Cubic)
+            {
+                for (int i = 0; i < bufSize; i++)
+                {
+                    // same polynomial as the float version, coefficients doubled to stay integer and kept at Q31
+                    const int16_t* x = &data[base[i]];
+                    int64_t f = (int64_t)(frac[i] * 32768.0f);
+                    int64_t c1 = (int64_t)(x[2] - x[0]) << 15;
+                    int64_t c2 = (int64_t)(2 * x[0] - 5 * x[1] + 4 * x[2] - x[3]) << 15;
+                    int64_t c3 = (int64_t)(x[3] - x[0] + 3 * (x[1] - x[2])) << 15;
+                    int64_t y = ((((c3 * f >> 15) + c2) * f >> 15) + c1) * f >> 15;
+                    taps[i] = Fixed::Saturate(((int64_t)x[1] << 16) + y);
+                }
+            }
+            else if (Interpolation == InterpolationMode::Linear)
+            {
+                for (int i = 0; i < bufSize; i++)
+                {
+                    uint32_t f = (uint32_t)(frac[i] * 16384.0f);
+                    taps[i] = Fixed::Dot2(&data[base[i] + 1], (16384 - f) | (f << 16)) << 2;
+                }
+            }
+            else
+            {
+                for (int i = 0; i < bufSize; i++)
+                    taps[i] = (int32_t)data[base[i] + 1] << 16;
+            }
+        }
+
+        inline void AllpassLane(int lane, const T* input, const int* base, const float* frac, int bufSize)
+        {
+            T taps[BUFSIZE];
+            S written[BUFSIZE];
+            S* data = GetLane(lane);
+            T* output = Output[lane];
+            Gather(data, base, frac, taps, bufSize);
+            AllpassStep(input, taps, written, output, bufSize);
+            Write(data, written, bufSize);
+        }
+
+        inline void AllpassStep(const float* input, const float* taps, float* written, float* output, int bufSize)
+        {
+            for (int i = 0; i < bufSize; i++)
+            {
+                float inVal = input[i] + taps[i] * Feedback;
+                written[i] = inVal;
+                output[i] = taps[i] - inVal * Feedback;
+            }
+        }
+
+        // Saturates rather than wraps, an overdriven tank clips instead of exploding
+        inline void AllpassStep(const int32_t* input, const int32_t* taps, int16_t* written, int32_t* output, int bufSize)
+        {
+            int16_t feedback = Fixed::GainToQ15(Feedback);
+            for (int i = 0; i < bufSize; i++)
+            {
+                int32_t inVal = Fixed::QAdd(input[i], Fixed::MulQ15(taps[i], feedback));
+                written[i] = Fixed::ToQ15(inVal);
+                output[i] = Fixed::QSub(taps[i], Fixed::MulQ15(inVal, feedback));
+            }
+        }
+
+        inline void WriteInput(float* data, const float* input, int bufSize)
+        {
+            Write(data, input, bufSize);
+        }
+
+        inline void WriteInput(int16_t* data, const int32_t* input, int bufSize)
+        {
+            int16_t values[BUFSIZE];
+            for (int i = 0; i < bufSize; i++)
+                values[i] = Fixed::ToQ15(input[i]);
+            Write(data, values, bufSize);
+        }
+
+        inline void Write(S* data, const S* values, int bufSize)
+        {
+            int first = Size - Index;
+            if (first > bufSize)
+                first = bufSize;
+
+            memcpy(&data[Index], values, first * sizeof(S));
+            if (first < bufSize)
+                memcpy(data, &values[first], (bufSize - first) * sizeof(S));
+
+            for (int i = 0; i < Guard; i++)
+                data[Size + i] = data[i];
+        }
+
+        inline void Advance(int bufSize)
+        {
+            Index += bufSize;
+            if (Index >= Size)
+                Index -= Size;
+        }
+    };
+
+    template<int N, int BUFSIZE, typename T = float>
+    class ModulatedAllpass : public ModulatedLine<N, BUFSIZE, 1, T>
+    {
+    public:
+        inline void Process(T* input, int bufSize)
+        {
+            this->ProcessAllpass(input, bufSize);
+        }
+    };
+
+    template<int N, int BUFSIZE, typename T = float>
+    class ModulatedDelay : public ModulatedLine<N, BUFSIZE, 1, T>
+    {
+    public:
+        inline void Process(T* input, int bufSize)
+        {
+            this->ProcessDelay(input, bufSize);
+        }
+    };
+}
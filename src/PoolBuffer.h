@@ -0,0 +1,82 @@
+#pragma once
+
+#include <new>
+#include <type_traits>
+#include "Polygons.h"
+#include "Constants.h"
+#include "RtCheck.h"
+
+#ifdef Z4_HOST
+#include <cassert>
+#endif
+
+namespace Z4
+{
+    // A scratch buffer from the shared Polygons::Buffers pool, returned when it goes out of scope.
+    // Wraps Buffers::Request() so that the real-time checker can track how deep into the pool the audio path goes.
+    //
+    // Off-device (Z4_HOST) engines may run on several threads at once, which the single shared pool
+    // doesn't allow for, so there every thread gets its own pool. Buffers are released in reverse
+    // order of acquisition (they are scoped), so a depth counter is all the bookkeeping it needs.
+    class PoolBuffer
+    {
+#ifdef Z4_HOST
+    public:
+        static const int HostPoolSize = 16;
+
+    private:
+        static inline int& HostDepth() { static thread_local int depth = 0; return depth; }
+
+        // raw storage, the samples in it are created by the constructor and As().
+        // Every block below index is still in use, so running out is a bug rather than something to wrap around
+        static inline void* HostBlock(int index)
+        {
+            alignas(16) static thread_local unsigned char blocks[HostPoolSize][BUFFER_SIZE * sizeof(float)];
+            assert(index < HostPoolSize && "host buffer pool exhausted, raise PoolBuffer::HostPoolSize");
+            return blocks[index];
+        }
+#else
+        decltype(Buffers::Request()) Handle;
+#endif
+
+    public:
+        float* Ptr;
+
+#ifdef Z4_HOST
+        inline PoolBuffer()
+        {
+            Ptr = ::new (HostBlock(HostDepth()++)) float[BUFFER_SIZE];
+            RtCheck::OnPoolAcquire();
+        }
+#else
+        inline PoolBuffer() : Handle(Buffers::Request())
+        {
+            Ptr = Handle.Ptr;
+            RtCheck::OnPoolAcquire();
+        }
+#endif
+
+        // The pool holds float blocks, the Q31 engine reuses them as int32_t. Rather than reading the floats
+        // through an int32_t pointer, which breaks strict aliasing, the storage is reused for an array of T.
+        // T is trivial, so creating the array compiles to nothing. Ptr mustn't be used once the block is reused
+        template<typename T>
+        inline T* As()
+        {
+            static_assert(sizeof(T) == sizeof(float) && alignof(T) <= alignof(float), "pool blocks hold 4 byte samples");
+            static_assert(std::is_trivially_default_constructible<T>::value && std::is_trivially_destructible<T>::value,
+                "pool blocks are reused without constructors or destructors");
+            return ::new ((void*)Ptr) T[BUFFER_SIZE];
+        }
+
+        inline ~PoolBuffer()
+        {
+#ifdef Z4_HOST
+            HostDepth()--;
+#endif
+            RtCheck::OnPoolRelease();
+        }
+
+        PoolBuffer(const PoolBuffer&) = delete;
+        PoolBuffer& operator=(const PoolBuffer&) = delete;
+    };
+}
@@ -0,0 +1,387 @@
+#pragma once
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "Polygons.h"
+#include "ParameterZ4.h"
+#include "Log.h"
+#ifndef Z4_HOST
+#include <SD.h>
+#endif
+
+namespace Z4
+{
+    // Stores each preset slot in its own small file, with two alternating copies per slot.
+    // Every copy carries a version, the parameter count, a sequence number and a CRC32, so a torn write
+    // only ever damages the copy being written and the previous one is used instead.
+    //
+    // Writes are deferred: Store() only records the values, and once the debounce time has passed Update(),
+    // called from loop(), writes the pending slots one file system step per call (remove, open, one sector, close),
+    // so a loop() pass only ever waits for a single SD operation.
+    template<int SlotCount>
+    class PresetStore
+    {
+    public:
+        enum class WriteResult
+        {
+            None = 0,
+            Ok = 1,
+            Failed = 2,
+        };
+
+        // Version 0 is the old raw Z4/presets.bin, which has no header
+        static const uint16_t Version = 3;
+
+    private:
+        static const uint32_t Magic = 0x5350345A; // "Z4PS"
+        static const int MaxParamCount = 64;
+        static const int LegacyParamCount = 18;
+        static const int WriteDelayMillis = 250;
+        static const int SectorSize = 512;
+
+        struct Header
+        {
+            uint32_t Magic;
+            uint16_t Version;
+            uint16_t ParamCount;
+            uint32_t Sequence;
+        };
+
+        static const int FileSize = sizeof(Header) + Parameter::COUNT * sizeof(uint16_t) + sizeof(uint32_t);
+
+        enum class WriteStage
+        {
+            Idle = 0,
+            Remove,
+            Open,
+            Write,
+            Close,
+        };
+
+        uint16_t Pending[SlotCount][Parameter::COUNT];
+        bool Dirty[SlotCount];
+        uint32_t Sequence[SlotCount];
+        uint8_t NextCopy[SlotCount];
+        uint32_t DirtyTime;
+
+        // the write in progress
+        WriteStage Stage;
+        int WriteSlotIndex;
+        int WriteOffset;
+        bool WriteFailed;
+        uint32_t WriteStepMaxMicros;
+        uint8_t WriteData[FileSize];
+        char WritePath[32];
+#ifndef Z4_HOST
+        File WriteHandle;
+#endif
+
+    public:
+        PresetStore()
+        {
+            for (int i = 0; i < SlotCount; i++)
+            {
+                Dirty[i] = false;
+                Sequence[i] = 0;
+                NextCopy[i] = 0;
+            }
+            DirtyTime = 0;
+            Stage = WriteStage::Idle;
+            WriteSlotIndex = 0;
+            WriteOffset = 0;
+            WriteFailed = false;
+            WriteStepMaxMicros = 0;
+        }
+
+        // Fills presets (SlotCount * Parameter::COUNT values) from the card.
+        // Slots without a valid copy are set to defaults, an old presets.bin is migrated if no slot files exist yet.
+        void LoadAll(uint16_t* presets)
+        {
+            bool anyFound = false;
+            for (int slot = 0; slot < SlotCount; slot++)
+            {
+                auto values = &presets[slot * Parameter::COUNT];
+                if (LoadSlot(slot, values))
+                    anyFound = true;
+                else
+                    SetDefaults(values);
+            }
+
+            if (!anyFound)
+            {
+                Storage::CreateFolder("Z4");
+                if (LoadLegacy(presets))
+                    Z4_LOG_INFO("Migrated presets from Z4/presets.bin");
+
+                // one-off at first boot, written straight away rather than queued
+                for (int slot = 0; slot < SlotCount; slot++)
+                    WriteSlot(slot, &presets[slot * Parameter::COUNT]);
+            }
+        }
+
+        void Store(int slot, uint16_t* values)
+        {
+            for (int i = 0; i < Parameter::COUNT; i++)
+                Pending[slot][i] = values[i];
+            Dirty[slot] = true;
+            DirtyTime = millis();
+        }
+
+        // Does at most one file system step, returns the result when a slot has been written
+        WriteResult Update()
+        {
+            if (Stage != WriteStage::Idle)
+                return WriteStep();
+
+            if (millis() - DirtyTime < WriteDelayMillis)
+                return WriteResult::None;
+
+            for (int slot = 0; slot < SlotCount; slot++)
+            {
+                if (!Dirty[slot])
+                    continue;
+
+                // a Store() to this slot while it's being written marks it dirty again, and it's written once more
+                Dirty[slot] = false;
+                BeginWrite(slot, Pending[slot]);
+                return WriteResult::None;
+            }
+
+            return WriteResult::None;
+        }
+
+        static void SetDefaults(uint16_t* values)
+        {
+            for (int i = 0; i < Parameter::COUNT; i++)
+                values[i] = 0;
+        }
+
+        // Brings values stored by an older version up to the current meaning of each parameter
+        static void Migrate(uint16_t* values, int fromVersion)
+        {
+            if (fromVersion < 1)
+            {
+                // Input Mode gained Dual Mono and True Stereo, which moved the raw values of Left and Right
+                int oldMode = (int)(values[Parameter::InputMode] / 8.0 * 2.999);
+                values[Parameter::InputMode] = oldMode * 2;
+            }
+            if (fromVersion < 2)
+            {
+                // Quality went from Low/High to Low/High/Ultra, only the top position used to be High
+                values[Parameter::Interpolation] = values[Parameter::Interpolation] >= 8 ? 4 : 0;
+            }
+            if (fromVersion < 3)
+            {
+                // Shimmer gained the five low latency modes, keep the stored mode where it was
+                int oldMode = (int)(values[Parameter::Shimmer] / 64.0 * 5.999);
+                values[Parameter::Shimmer] = (uint16_t)ceil(oldMode * 64 / 10.999);
+            }
+        }
+
+    private:
+        static void GetPath(int slot, int copy, char* dest)
+        {
+            sprintf(dest, "Z4/preset%d%c.bin", slot, copy == 0 ? 'a' : 'b');
+        }
+
+        static uint32_t Crc32(const uint8_t* data, int len, uint32_t crc = 0)
+        {
+            crc = ~crc;
+            for (int i = 0; i < len; i++)
+            {
+                crc ^= data[i];
+                for (int k = 0; k < 8; k++)
+                    crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+            }
+            return ~crc;
+        }
+
+        // Reads one copy, returns false if it is missing or fails validation
+        bool ReadCopy(int slot, int copy, Header* header, uint16_t* values)
+        {
+            char path[32];
+            GetPath(slot, copy, path);
+            if (!Storage::FileExists(path))
+                return false;
+
+            uint8_t data[sizeof(Header) + MaxParamCount * sizeof(uint16_t) + sizeof(uint32_t)];
+            if (!Storage::ReadFile(path, data, sizeof(Header)))
+                return false;
+
+            memcpy(header, data, sizeof(Header));
+            if (header->Magic != Magic || header->Version > Version || header->ParamCount == 0 || header->ParamCount > MaxParamCount)
+                return false;
+
+            int payload = sizeof(Header) + header->ParamCount * sizeof(uint16_t);
+            if (!Storage::ReadFile(path, data, payload + sizeof(uint32_t)))
+                return false;
+
+            uint32_t crc;
+            memcpy(&crc, &data[payload], sizeof(crc));
+            if (crc != Crc32(data, payload))
+                return false;
+
+            // parameters added since the file was written get their defaults, removed ones are dropped
+            SetDefaults(values);
+            int count = header->ParamCount < Parameter::COUNT ? header->ParamCount : Parameter::COUNT;
+            memcpy(values, &data[sizeof(Header)], count * sizeof(uint16_t));
+            Migrate(values, header->Version);
+            return true;
+        }
+
+        bool LoadSlot(int slot, uint16_t* values)
+        {
+            Header headers[2];
+            uint16_t copies[2][Parameter::COUNT];
+            bool valid[2];
+            valid[0] = ReadCopy(slot, 0, &headers[0], copies[0]);
+            valid[1] = ReadCopy(slot, 1, &headers[1], copies[1]);
+
+            if (!valid[0] && !valid[1])
+                return false;
+
+            int newest = !valid[1] || (valid[0] && headers[0].Sequence >= headers[1].Sequence) ? 0 : 1;
+            for (int i = 0; i < Parameter::COUNT; i++)
+                values[i] = copies[newest][i];
+
+            // the next write goes over the older (or damaged) copy
+            Sequence[slot] = headers[newest].Sequence;
+            NextCopy[slot] = 1 - newest;
+            return true;
+        }
+
+        bool LoadLegacy(uint16_t* presets)
+        {
+            if (!Storage::FileExists("Z4/presets.bin"))
+                return false;
+
+            uint16_t legacy[SlotCount * LegacyParamCount];
+            if (!Storage::ReadFile("Z4/presets.bin", (uint8_t*)legacy, sizeof(legacy)))
+                return false;
+
+            for (int slot = 0; slot < SlotCount; slot++)
+            {
+                auto values = &presets[slot * Parameter::COUNT];
+                SetDefaults(values);
+                int count = LegacyParamCount < Parameter::COUNT ? LegacyParamCount : Parameter::COUNT;
+                for (int i = 0; i < count; i++)
+                    values[i] = legacy[slot * LegacyParamCount + i];
+                Migrate(values, 0);
+            }
+            return true;
+        }
+
+        // Encodes the file for the slot's next copy, the file system isn't touched until WriteStep()
+        void BeginWrite(int slot, uint16_t* values)
+        {
+            Header header;
+            header.Magic = Magic;
+            header.Version = Version;
+            header.ParamCount = Parameter::COUNT;
+            header.Sequence = Sequence[slot] + 1;
+
+            int payload = sizeof(Header) + Parameter::COUNT * sizeof(uint16_t);
+            memcpy(WriteData, &header, sizeof(Header));
+            memcpy(&WriteData[sizeof(Header)], values, Parameter::COUNT * sizeof(uint16_t));
+            uint32_t crc = Crc32(WriteData, payload);
+            memcpy(&WriteData[payload], &crc, sizeof(crc));
+
+            GetPath(slot, NextCopy[slot], WritePath);
+            WriteSlotIndex = slot;
+            WriteOffset = 0;
+            WriteFailed = false;
+            WriteStepMaxMicros = 0;
+            Stage = WriteStage::Remove;
+        }
+
+        WriteResult WriteStep()
+        {
+            uint32_t start = micros();
+            switch (Stage)
+            {
+            case WriteStage::Remove:
+                // the copy being replaced may be longer, written by a version with more parameters
+                RemoveFile();
+                Stage = WriteStage::Open;
+                break;
+            case WriteStage::Open:
+                WriteFailed = !OpenFile();
+                Stage = WriteFailed ? WriteStage::Idle : WriteStage::Write;
+                break;
+            case WriteStage::Write:
+            {
+                int count = FileSize - WriteOffset < SectorSize ? FileSize - WriteOffset : SectorSize;
+                WriteFailed = !WriteChunk(WriteOffset, count);
+                WriteOffset += count;
+                if (WriteFailed || WriteOffset >= FileSize)
+                    Stage = WriteStage::Close;
+                break;
+            }
+            case WriteStage::Close:
+                // closing flushes the data and updates the directory entry
+                WriteFailed = !CloseFile() || WriteFailed;
+                Stage = WriteStage::Idle;
+                break;
+            default:
+                return WriteResult::None;
+            }
+
+            uint32_t elapsed = micros() - start;
+            if (elapsed > WriteStepMaxMicros)
+                WriteStepMaxMicros = elapsed;
+
+            if (Stage != WriteStage::Idle)
+                return WriteResult::None;
+
+            Z4_LOG_DEBUG("Preset slot %d written, longest step %dus", WriteSlotIndex, (int)WriteStepMaxMicros);
+            if (WriteFailed)
+                return WriteResult::Failed;
+
+            Sequence[WriteSlotIndex]++;
+            NextCopy[WriteSlotIndex] = 1 - NextCopy[WriteSlotIndex];
+            return WriteResult::Ok;
+        }
+
+        // Only used at first boot, where blocking is fine
+        bool WriteSlot(int slot, uint16_t* values)
+        {
+            BeginWrite(slot, values);
+            WriteResult result = WriteResult::None;
+            while (Stage != WriteStage::Idle)
+                result = WriteStep();
+            return result == WriteResult::Ok;
+        }
+
+#ifndef Z4_HOST
+        void RemoveFile()
+        {
+            if (SD.exists(WritePath))
+                SD.remove(WritePath);
+        }
+
+        bool OpenFile()
+        {
+            WriteHandle = SD.open(WritePath, FILE_WRITE);
+            return (bool)WriteHandle;
+        }
+
+        bool WriteChunk(int offset, int count)
+        {
+            return WriteHandle.write(&WriteData[offset], count) == (size_t)count;
+        }
+
+        bool CloseFile()
+        {
+            WriteHandle.close();
+            return true;
+        }
+#else
+        // Off-device the whole file goes through Storage when it's closed
+        void RemoveFile() {}
+        bool OpenFile() { return true; }
+        bool WriteChunk(int, int) { return true; }
+        bool CloseFile() { return Storage::WriteFile(WritePath, WriteData, FileSize); }
+#endif
+    };
+}
@@ -0,0 +1,334 @@
+#pragma once
+
+// Host-side real-time safety checker. Build with Z4_HOST and Z4_RT_CHECK defined, and define
+// Z4_RT_CHECK_IMPLEMENTATION in exactly one translation unit to install the interposers below.
+//
+// Everything that runs inside an AudioScope (Controller::Process opens one) is watched for heap
+// allocation, mutex locks, blocking I/O and sleeps, and for scratch buffer pool overflow. Each
+// violation is counted, and the first one from each call site is reported on stderr with a stack trace.
+// Call sites are told apart by a hash of the innermost return addresses, PrintSummary() gives the totals.
+// Only calls that go through the dynamic linker are seen, glibc-internal locks are not.
+//
+// Without Z4_RT_CHECK every hook compiles to nothing.
+
+#ifdef Z4_RT_CHECK
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <execinfo.h>
+#include <unistd.h>
+
+namespace Z4
+{
+    namespace RtCheck
+    {
+        enum class Kind
+        {
+            Allocation = 0,
+            Lock = 1,
+            BlockingIO = 2,
+            PoolOverflow = 3,
+            Count = 4,
+        };
+
+        const int MaxSites = 64;
+        const int SiteDepth = 8; // return addresses hashed per call site
+
+        inline int& ScopeDepth() { static thread_local int depth = 0; return depth; }
+        inline bool& Reporting() { static thread_local bool reporting = false; return reporting; }
+        inline int& PoolInUse() { static thread_local int inUse = 0; return inUse; }
+        inline int& PoolPeak() { static thread_local int peak = 0; return peak; }
+        inline std::atomic<int>* Counts() { static std::atomic<int> counts[(int)Kind::Count]; return counts; }
+        inline std::atomic<uint64_t>* Sites() { static std::atomic<uint64_t> sites[MaxSites]; return sites; }
+        inline std::atomic<int>& SiteCount() { static std::atomic<int> count(0); return count; }
+        inline std::atomic<int>& UnlistedCount() { static std::atomic<int> count(0); return count; } // violations after the site table filled up
+
+        // Scratch buffers the audio path may hold at once, 0 leaves it unchecked. The checker probes it from Polygons::Buffers
+        inline int& PoolSize() { static int size = 0; return size; }
+        inline void SetPoolSize(int size) { PoolSize() = size; }
+
+        inline const char* KindName(Kind kind)
+        {
+            switch (kind)
+            {
+                case Kind::Allocation:      return "heap allocation";
+                case Kind::Lock:            return "lock";
+                case Kind::BlockingIO:      return "blocking I/O";
+                case Kind::PoolOverflow:    return "buffer pool overflow";
+                default:                    return "unknown";
+            }
+        }
+
+        inline bool InAudioScope()
+        {
+            return ScopeDepth() > 0 && !Reporting();
+        }
+
+        // Returns 1 the first time a site is seen, 0 after that, -1 when the table is full
+        inline int AddSite(void** frames, int count)
+        {
+            uint64_t hash = 14695981039346656037ull; // FNV-1a over the addresses
+            for (int i = 0; i < count && i < SiteDepth; i++)
+            {
+                hash ^= (uint64_t)(uintptr_t)frames[i];
+                hash *= 1099511628211ull;
+            }
+            if (hash == 0)
+                hash = 1;
+
+            for (int i = 0; i < MaxSites; i++)
+            {
+                uint64_t site = 0;
+                if (Sites()[i].compare_exchange_strong(site, hash))
+                {
+                    SiteCount()++;
+                    return 1;
+                }
+                if (site == hash)
+                    return 0;
+            }
+            return -1;
+        }
+
+        inline void Violation(Kind kind, const char* what)
+        {
+            if (!InAudioScope())
+                return;
+
+            // anything called while reporting (backtrace may allocate) must not recurse
+            Reporting() = true;
+            Counts()[(int)kind]++;
+
+            void* frames[32];
+            int count = backtrace(frames, 32);
+            int site = AddSite(frames, count);
+            if (site > 0)
+            {
+                char line[160];
+                int len = snprintf(line, sizeof(line), "RtCheck: %s (%s) in the audio path\n", KindName(kind), what);
+                if (write(2, line, len) < 0) { }
+                backtrace_symbols_fd(frames, count, 2);
+            }
+            else if (site < 0)
+                UnlistedCount()++;
+            Reporting() = false;
+        }
+
+        inline int GetCount(Kind kind)
+        {
+            return Counts()[(int)kind];
+        }
+
+        inline int GetTotalCount()
+        {
+            int total = 0;
+            for (int i = 0; i < (int)Kind::Count; i++)
+                total += Counts()[i];
+            return total;
+        }
+
+        inline void ResetCounts()
+        {
+            for (int i = 0; i < (int)Kind::Count; i++)
+                Counts()[i] = 0;
+            for (int i = 0; i < MaxSites; i++)
+                Sites()[i] = 0;
+            SiteCount() = 0;
+            UnlistedCount() = 0;
+            PoolPeak() = 0;
+        }
+
+        // Totals per kind and how many distinct call sites they came from, on stdout
+        inline void PrintSummary()
+        {
+            printf("RtCheck: %d violations from %d call sites", GetTotalCount(), (int)SiteCount());
+            if (UnlistedCount() > 0)
+                printf(", %d more after the first %d sites weren't traced", (int)UnlistedCount(), MaxSites);
+            printf("\n");
+            for (int k = 0; k < (int)Kind::Count; k++)
+                printf("  %-22s %d\n", KindName((Kind)k), GetCount((Kind)k));
+        }
+
+        inline void OnPoolAcquire()
+        {
+            int inUse = ++PoolInUse();
+            if (inUse > PoolPeak())
+                PoolPeak() = inUse;
+            if (PoolSize() > 0 && inUse > PoolSize())
+                Violation(Kind::PoolOverflow, "Buffers::Request");
+        }
+
+        inline void OnPoolRelease()
+        {
+            --PoolInUse();
+        }
+
+        class AudioScope
+        {
+        public:
+            AudioScope() { ScopeDepth()++; }
+            ~AudioScope() { ScopeDepth()--; }
+        };
+    }
+}
+
+#define Z4_RT_AUDIO_SCOPE() Z4::RtCheck::AudioScope z4RtAudioScope
+
+#ifdef Z4_RT_CHECK_IMPLEMENTATION
+
+#include <dlfcn.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <time.h>
+
+// glibc keeps the real allocator reachable under these names
+extern "C" void* __libc_malloc(size_t size);
+extern "C" void* __libc_calloc(size_t count, size_t size);
+extern "C" void* __libc_realloc(void* ptr, size_t size);
+extern "C" void* __libc_memalign(size_t alignment, size_t size);
+extern "C" void __libc_free(void* ptr);
+
+namespace Z4
+{
+    namespace RtCheck
+    {
+        template<typename T>
+        inline T Real(const char* name)
+        {
+            return (T)dlsym(RTLD_NEXT, name);
+        }
+    }
+}
+
+extern "C"
+{
+    void* malloc(size_t size)
+    {
+        Z4::RtCheck::Violation(Z4::RtCheck::Kind::Allocation, "malloc");
+        return __libc_malloc(size);
+    }
+
+    void* calloc(size_t count, size_t size)
+    {
+        Z4::RtCheck::Violation(Z4::RtCheck::Kind::Allocation, "calloc");
+        return __libc_calloc(count, size);
+    }
+
+    void* realloc(void* ptr, size_t size)
+    {
+        Z4::RtCheck::Violation(Z4::RtCheck::Kind::Allocation, "realloc");
+        return __libc_realloc(ptr, size);
+    }
+
+    void* memalign(size_t alignment, size_t size)
+    {
+        Z4::RtCheck::Violation(Z4::RtCheck::Kind::Allocation, "memalign");
+        return __libc_memalign(alignment, size);
+    }
+
+    int posix_memalign(void** ptr, size_t alignment, size_t size)
+    {
+        Z4::RtCheck::Violation(Z4::RtCheck::Kind::Allocation, "posix_memalign");
+        *ptr = __libc_memalign(alignment, size);
+        return *ptr == nullptr ? 12 : 0; // ENOMEM
+    }
+
+    void free(void* ptr)
+    {
+        if (ptr != nullptr)
+            Z4::RtCheck::Violation(Z4::RtCheck::Kind::Allocation, "free");
+        __libc_free(ptr);
+    }
+
+    int pthread_mutex_lock(pthread_mutex_t* mutex)
+    {
+        static auto real = Z4::RtCheck::Real<int(*)(pthread_mutex_t*)>("pthread_mutex_lock");
+        Z4::RtCheck::Violation(Z4::RtCheck::Kind::Lock, "pthread_mutex_lock");
+        return real(mutex);
+    }
+
+    int pthread_rwlock_rdlock(pthread_rwlock_t* lock)
+    {
+        static auto real = Z4::RtCheck::Real<int(*)(pthread_rwlock_t*)>("pthread_rwlock_rdlock");
+        Z4::RtCheck::Violation(Z4::RtCheck::Kind::Lock, "pthread_rwlock_rdlock");
+        return real(lock);
+    }
+
+    int pthread_rwlock_wrlock(pthread_rwlock_t* lock)
+    {
+        static auto real = Z4::RtCheck::Real<int(*)(pthread_rwlock_t*)>("pthread_rwlock_wrlock");
+        Z4::RtCheck::Violation(Z4::RtCheck::Kind::Lock, "pthread_rwlock_wrlock");
+        return real(lock);
+    }
+
+    ssize_t write(int fd, const void* data, size_t size)
+    {
+        static auto real = Z4::RtCheck::Real<ssize_t(*)(int, const void*, size_t)>("write");
+        Z4::RtCheck::Violation(Z4::RtCheck::Kind::BlockingIO, "write");
+        return real(fd, data, size);
+    }
+
+    ssize_t read(int fd, void* data, size_t size)
+    {
+        static auto real = Z4::RtCheck::Real<ssize_t(*)(int, void*, size_t)>("read");
+        Z4::RtCheck::Violation(Z4::RtCheck::Kind::BlockingIO, "read");
+        return real(fd, data, size);
+    }
+
+    size_t fwrite(const void* data, size_t size, size_t count, FILE* file)
+    {
+        static auto real = Z4::RtCheck::Real<size_t(*)(const void*, size_t, size_t, FILE*)>("fwrite");
+        Z4::RtCheck::Violation(Z4::RtCheck::Kind::BlockingIO, "fwrite");
+        return real(data, size, count, file);
+    }
+
+    int puts(const char* str)
+    {
+        static auto real = Z4::RtCheck::Real<int(*)(const char*)>("puts");
+        Z4::RtCheck::Violation(Z4::RtCheck::Kind::BlockingIO, "puts");
+        return real(str);
+    }
+
+    int printf(const char* format, ...)
+    {
+        Z4::RtCheck::Violation(Z4::RtCheck::Kind::BlockingIO, "printf");
+        va_list args;
+        va_start(args, format);
+        int result = vprintf(format, args);
+        va_end(args);
+        return result;
+    }
+
+    int nanosleep(const struct timespec* req, struct timespec* rem)
+    {
+        static auto real = Z4::RtCheck::Real<int(*)(const struct timespec*, struct timespec*)>("nanosleep");
+        Z4::RtCheck::Violation(Z4::RtCheck::Kind::BlockingIO, "nanosleep");
+        return real(req, rem);
+    }
+
+    int usleep(useconds_t usec)
+    {
+        static auto real = Z4::RtCheck::Real<int(*)(useconds_t)>("usleep");
+        Z4::RtCheck::Violation(Z4::RtCheck::Kind::BlockingIO, "usleep");
+        return real(usec);
+    }
+}
+
+#endif // Z4_RT_CHECK_IMPLEMENTATION
+
+#else
+
+#define Z4_RT_AUDIO_SCOPE() do {} while (0)
+
+namespace Z4
+{
+    namespace RtCheck
+    {
+        inline void OnPoolAcquire() { }
+        inline void OnPoolRelease() { }
+    }
+}
+
+#endif // Z4_RT_CHECK
@@ -3,6 +3,7 @@
 #include "Polygons.h"
 #include "ParameterZ4.h"
 #include "ControllerZ4.h"
+#include "PresetStore.h"
 #include "Utils.h"
 
 namespace Z4
@@ -16,11 +17,28 @@ namespace Z4
     int InputClip, OutputClip = 0;
     bool PresetButtonPressed = false;
     int PresetButtonPressTime = 0;
-
-    Controller controller(SAMPLERATE);
+    volatile bool PresetsLoaded = false; // read by the audio callback
+    volatile uint32_t FirstAudioMicros = 0; // time since boot when the first audio block was processed, set by the audio callback
+    uint32_t PresetsLoadedMicros = 0;
+    bool FirstAudioReported = false;
+
+    // Audio runs before the presets are read, but stays muted until the user's preset is loaded and then fades in,
+    // rather than playing the compiled-in defaults and jumping
+    float StartupFade = 0;
+    const float StartupFadeStep = 1.0f / (0.05f * SAMPLERATE); // 50ms
+
+    // Building with Z4_FIXED_POINT runs the Q31 engine straight on the codec buffers
+#ifdef Z4_FIXED_POINT
+    typedef ControllerFixed AudioController;
+#else
+    typedef Controller AudioController;
+#endif
+    DMAMEM AudioController::Tank ReverbTank;
+    AudioController controller(SAMPLERATE, &ReverbTank);
     PolyOS os;
 
-    uint16_t Presets[Parameter::COUNT * PRESET_COUNT];\
+    uint16_t Presets[Parameter::COUNT * PRESET_COUNT];
+    PresetStore<PRESET_COUNT> presetStore;
     uint8_t currentPreset;
 
     void loadPreset(int number);
@@ -116,7 +134,9 @@ namespace Z4
             sprintf(dest, "%d", (int)val);
         else if (paramId == Parameter::Interpolation)
         {
-            if (val > 0.5)
+            if ((int)val == 2)
+                strcpy(dest, "Ultra");
+            else if ((int)val == 1)
                 strcpy(dest, "High");
             else
                 strcpy(dest, "Low");
@@ -135,6 +155,16 @@ namespace Z4
                 strcpy(dest, "Mix Down");
             else if (val == 5)
                 strcpy(dest, "Mix UpDown");
+            else if (val == 6)
+                strcpy(dest, "Fast Up");
+            else if (val == 7)
+                strcpy(dest, "Fast Down");
+            else if (val == 8)
+                strcpy(dest, "Fast Mix Up");
+            else if (val == 9)
+                strcpy(dest, "Fast Mix Dn");
+            else if (val == 10)
+                strcpy(dest, "Fast Mix UpDn");
         }
         else if (paramId == Parameter::InputMode)
         {
@@ -142,8 +172,12 @@ namespace Z4
                 strcpy(dest, "Stereo");
             else if ((int)val == 1)
                 strcpy(dest, "Left");
-            else
+            else if ((int)val == 2)
                 strcpy(dest, "Right");
+            else if ((int)val == 3)
+                strcpy(dest, "Dual Mono");
+            else
+                strcpy(dest, "True Stereo");
         }
         else if (paramId == Parameter::InGain || paramId == Parameter::OutGain)
         {
@@ -213,8 +247,56 @@ namespace Z4
        return false;
     }
 
+    template<typename T>
+    inline void applyStartupFade(T** outputs)
+    {
+        if (StartupFade >= 1)
+            return;
+
+        float fade = StartupFade;
+        for (size_t i = 0; i < AUDIO_BLOCK_SAMPLES; i++)
+        {
+            if (PresetsLoaded)
+                fade = fade + StartupFadeStep > 1 ? 1 : fade + StartupFadeStep;
+            outputs[0][i] = (T)(outputs[0][i] * fade);
+            outputs[1][i] = (T)(outputs[1][i] * fade);
+        }
+        StartupFade = fade;
+    }
+
+    // Compared against both bounds, abs() of INT32_MIN overflows
+    inline bool isClipped(int32_t sample, int32_t level)
+    {
+        return sample >= level || sample <= -level;
+    }
+
     void audioCallback(int32_t** inputs, int32_t** outputs)
     {
+        if (FirstAudioMicros == 0)
+            FirstAudioMicros = micros();
+
+#ifdef Z4_FIXED_POINT
+        const int32_t inputClipLevel = (int32_t)(0.88 * SAMPLE_32_MAX);
+        const int32_t outputClipLevel = (int32_t)(0.98 * SAMPLE_32_MAX);
+        for (size_t i = 0; i < AUDIO_BLOCK_SAMPLES; i++)
+        {
+            if (isClipped(inputs[0][i], inputClipLevel) || isClipped(inputs[1][i], inputClipLevel))
+                InputClip = 10000;
+            else
+                InputClip = InputClip > 0 ? InputClip - 1 : 0;
+        }
+
+        controller.Process(inputs, outputs, AUDIO_BLOCK_SAMPLES);
+        applyStartupFade(outputs);
+
+        for (size_t i = 0; i < AUDIO_BLOCK_SAMPLES; i++)
+        {
+            if (isClipped(outputs[0][i], outputClipLevel) || isClipped(outputs[1][i], outputClipLevel))
+                OutputClip = 10000;
+            else
+                OutputClip = OutputClip > 0 ? OutputClip - 1 : 0;
+        }
+#else
         float scaler = (float)(1.0 / (double)SAMPLE_32_MAX);
         for (size_t i = 0; i < AUDIO_BLOCK_SAMPLES; i++)
         {
@@ -231,6 +313,7 @@ namespace Z4
         float* outs[2] = {BufferOutL, BufferOutR};
 
         controller.Process(ins, outs, AUDIO_BLOCK_SAMPLES);
+        applyStartupFade(outs);
 
         for (size_t i = 0; i < AUDIO_BLOCK_SAMPLES; i++)
         {
@@ -242,6 +325,7 @@ namespace Z4
             else
                 OutputClip = OutputClip > 0 ? OutputClip - 1 : 0;
         }
+#endif
     }
 
     void loadPreset(int number)
@@ -268,28 +352,24 @@ namespace Z4
         {
             preset[i] = rawParams[i];
         }
-        bool ok = Storage::WriteFile("Z4/presets.bin", (uint8_t*)Presets, sizeof(Presets));
-        if (ok)
+        // only the changed slot is written, from loop(), see updatePresetStore()
+        presetStore.Store(number, preset);
+    }
+
+    inline void updatePresetStore()
+    {
+        auto result = presetStore.Update();
+        if (result == PresetStore<PRESET_COUNT>::WriteResult::Ok)
             os.menu.setMessage("Preset Stored", 1000);
-        else
+        else if (result == PresetStore<PRESET_COUNT>::WriteResult::Failed)
             os.menu.setMessage("Error writing preset!", 1000);
     }
 
     inline void LoadPresetsSD()
     {
-        if (Storage::FileExists("Z4/presets.bin"))
-        {
-            Serial.println("Reading presets from SD Card...");
-            Storage::ReadFile("Z4/presets.bin", (uint8_t*)Presets, sizeof(Presets));
-            Serial.println("Done reading presets");
-        }
-        else
-        {
-            Serial.println("No presets are present, writing to SD Card...");
-            Storage::CreateFolder("Z4");
-            Storage::WriteFile("Z4/presets.bin", (uint8_t*)Presets, sizeof(Presets));
-            Serial.println("Done writing presets");
-        }
+        Serial.println("Reading presets from SD Card...");
+        presetStore.LoadAll(Presets);
+        Serial.println("Done reading presets");
     }
 
     inline void start()
@@ -309,7 +389,12 @@ namespace Z4
         os.menu.getParameterName = getParameterName;
         os.menu.getParameterDisplay = getParameterDisplay;
         
-        LoadPresetsSD();
+        // Building with Z4_FDN_TANK runs the late tank as a feedback delay network instead of the ring
+#ifdef Z4_FDN_TANK
+        controller.SetTankMode(TankMode::Fdn);
+#endif
+
+        // Start audio straight away, muted, the SD card is read from the first loop() instead
         loadPreset(0);
         os.Parameters[os.getParamDigital(9)].Value = 1; // set Active toggle state to true
         controller.SetParameter(Parameter::Active, 1);
@@ -319,6 +404,21 @@ namespace Z4
 
     inline void loop()
     {
+        if (!PresetsLoaded)
+        {
+            LoadPresetsSD();
+            loadPreset(currentPreset);
+            PresetsLoadedMicros = micros();
+            PresetsLoaded = true;
+        }
+
+        if (!FirstAudioReported && FirstAudioMicros != 0)
+        {
+            Z4_LOG_INFO("Time to first audio: %.2fms, presets loaded and fading in at %.2fms",
+                FirstAudioMicros / 1000.0, PresetsLoadedMicros / 1000.0);
+            FirstAudioReported = true;
+        }
+
         if (PresetButtonPressed)
         {
             if (millis() - PresetButtonPressTime > 2000)
@@ -328,6 +428,9 @@ namespace Z4
             }
         }
 
+        updatePresetStore();
+        Log::Drain();
+
         os.loop();
     }
 }
@@ -1,11 +1,19 @@
 #pragma once
 
+#include <new>
 #include "Polygons.h"
-#include "blocks/ModulatedDelayHd.h"
-#include "blocks/ModulatedAllpassHd.h"
 #include "Constants.h"
+#include "EngineState.h"
+#include "Log.h"
+#include "PoolBuffer.h"
 #include "blocks/Biquad.h"
+#include "FixedPoint.h"
+#include "FixedBiquad.h"
 #include "GranularPitchShift.h"
+#include "LowLatencyPitchShift.h"
+#include "MixingMatrix.h"
+#include "ModulatedLine.h"
+#include "ModulatedAllpassStereo.h"
 
 using namespace Polygons;
 
@@ -14,21 +22,76 @@ namespace Z4
     const int PRE_DIFFUSE_COUNT = 12;
     const int ZCOUNT = 4;
 
-    DMAMEM GranularPitchShift<8000> PitchShifter1(FS_MAX, 0.5);
-    DMAMEM GranularPitchShift<8000> PitchShifter2(FS_MAX, 2.0);
-    DMAMEM ModulatedDelayHd<FS_MAX/8, BUFFER_SIZE> Delay[4]; // 125ms max delay
-    DMAMEM ModulatedAllpassHd<FS_MAX/10, BUFFER_SIZE> Diffuser[ZCOUNT*2]; // 100ms max delay
+    enum class StereoMode
+    {
+        Mono = 0,       // inputs summed before the pre-diffusers
+        DualMono = 1,   // separate left/right pre-diffuser lanes feeding the shared tank
+        TrueStereo = 2, // separate lanes feeding two decorrelated tanks, lines 0+2 and 1+3
+    };
 
-    class Z4Rev
+    enum class TankMode
     {
-        ModulatedAllpassHd<FS_MAX/10, BUFFER_SIZE> PreDiffuser[PRE_DIFFUSE_COUNT];    
-        Biquad lpPre, lpPost, hpPre, hpPost;
+        Ring = 0,       // each line feeds the next, two diffusers per line
+        Fdn = 1,        // feedback delay network, every line feeds every line of its tank through an
+                        // orthogonal mixing matrix, one diffuser per line
+    };
+
+    // Groups of state derived from the parameters, so a parameter change only recomputes what it affects
+    class DerivedState
+    {
+    public:
+        static const int Decay = 1;          // tank feedback gain
+        static const int Early = 2;          // pre-diffuser lines
+        static const int Late = 4;           // tank diffusers and delays
+        static const int LowPassPre = 8;
+        static const int HighPassPre = 16;
+        static const int LowPassPost = 32;
+        static const int HighPassPost = 64;
+        static const int All = 127;
+    };
+
+    // The filter type for each sample type
+    template<typename T> struct EngineFilter;
+    template<> struct EngineFilter<float> { typedef Biquad Type; };
+    template<> struct EngineFilter<int32_t> { typedef FixedBiquad Type; };
+
+    // The tank lines, the largest part of the engine. Kept apart from the engine so the firmware can place it in DMAMEM
+    template<typename T>
+    struct Z4RevTank
+    {
+        ModulatedDelay<FS_MAX/8, BUFFER_SIZE, T> Delay[ZCOUNT]; // 125ms max delay
+        ModulatedAllpass<FS_MAX/10, BUFFER_SIZE, T> Diffuser[ZCOUNT*2]; // 100ms max delay
+    };
+
+    // The reverb engine, for float (Z4Rev) or Q31 (Z4RevFixed) samples.
+    // The Q31 engine is the same structure on integer arithmetic: Q15 delay memory, saturating adds on
+    // every path into a line, and the float pitch shifters fed through a conversion. Its signals run
+    // Fixed::HeadroomBits below the codec level, the controller scales on the way in and out.
+    template<typename T>
+    class Z4RevT
+    {
+    public:
+        typedef T Sample;
+        typedef Z4RevTank<T> Tank;
+
+    private:
+        typedef typename EngineFilter<T>::Type Filter;
+
+        Tank* OwnedTank;
+        ModulatedDelay<FS_MAX/8, BUFFER_SIZE, T>* Delay;
+        ModulatedAllpass<FS_MAX/10, BUFFER_SIZE, T>* Diffuser;
+        ModulatedAllpassStereo<FS_MAX/10, BUFFER_SIZE, T> PreDiffuser[PRE_DIFFUSE_COUNT];
+        Filter lpPre, lpPost, hpPre, hpPost;
+        Filter lpPreR, lpPostR, hpPreR, hpPostR; // right channel filters, only used in the stereo modes
 
         // Delay lengths in milliseconds, handpicked arbitrarily :)
         float PreDiffuserSizes[PRE_DIFFUSE_COUNT] = {56.797, 59.12, 65.1785, 67.324, 69.7954, 72.55, 75.6531, 80.804, 83.157, 86.45, 90.234, 96.194};
         float DiffuserSizes[ZCOUNT] = {70.312, 78.5123, 87.9312, 92.1576};
         float DelaySizes[ZCOUNT] = {73.459, 95.961, 104.1248, 117.934};
 
+        // The FDN's single diffuser per line is shortened so it diffuses rather than adding another sparse echo
+        const float FdnDiffuserScale = 0.25;
+
         // Modulation rates in Hz, I used sequential prime numbers scaled down
         float PreDiffuserModRate[PRE_DIFFUSE_COUNT] = {13*0.05, 17*0.05, 19*0.05, 23*0.05, 29*0.05};
         float DiffuserModRate[ZCOUNT] = {31*0.02, 37*0.02, 41*0.02, 43*0.02};
@@ -44,16 +107,43 @@ namespace Z4
         float LateSize;
         float Modulation;
         float DiffuseFeedback;
-        bool Interpolation;
+        InterpolationMode Interpolation;
         int EarlyStages;
         bool freeze;
         float smoothedFreeze;
         int ShimmerMode;
+        StereoMode stereoMode;
+        TankMode tankMode;
+
+        // The pitch shifters are 16-32Kb each and most presets never use them,
+        // so they are only allocated the first time a shimmer mode needing them is selected.
+        // Slots: 0 = up, 1 = down, 2 = low latency up, 3 = low latency down
+        static const int ShifterCount = 4;
+        typedef GranularPitchShift<8000> PitchShifter;
+        typedef LowLatencyPitchShift<4096> FastPitchShifter;
+        PitchShifter* PitchShifters[2];
+        FastPitchShifter* FastPitchShifters[2];
+        bool shimmerRunning[ShifterCount];
+        float shimmerGain[ShifterCount];
+        float shimmerGainDirect;
+
+        // The last BUFFER_SIZE outputs of each line, for the feedback that crosses into the next block.
+        // Reading it as a ring rather than taking the previous block's output keeps the loop length
+        // the same when a block is split into shorter ones (automation), see MixFeedback()
+        T Feedback[ZCOUNT][BUFFER_SIZE];
+        int FeedbackIndex;
 
     public:
-        Z4Rev(int samplerate) : lpPre(Biquad::FilterType::LowPass, samplerate), lpPost(Biquad::FilterType::LowPass6db, samplerate),
-                                hpPre(Biquad::FilterType::HighPass, samplerate), hpPost(Biquad::FilterType::HighPass6db, samplerate)
+        // Without a tank the engine allocates its own, for hosts running several instances
+        Z4RevT(int samplerate, Tank* tank = nullptr) : lpPre(Biquad::FilterType::LowPass, samplerate), lpPost(Biquad::FilterType::LowPass6db, samplerate),
+                                hpPre(Biquad::FilterType::HighPass, samplerate), hpPost(Biquad::FilterType::HighPass6db, samplerate),
+                                lpPreR(Biquad::FilterType::LowPass, samplerate), lpPostR(Biquad::FilterType::LowPass6db, samplerate),
+                                hpPreR(Biquad::FilterType::HighPass, samplerate), hpPostR(Biquad::FilterType::HighPass6db, samplerate)
         {
+            OwnedTank = tank == nullptr ? new Tank() : nullptr;
+            Delay = tank == nullptr ? OwnedTank->Delay : tank->Delay;
+            Diffuser = tank == nullptr ? OwnedTank->Diffuser : tank->Diffuser;
+
             Samplerate = samplerate;
             Krt = 0.0;
             T60 = 5.0;
@@ -64,40 +154,100 @@ namespace Z4
             LateSize = 0.1;
             Modulation = 0.2;
             DiffuseFeedback = 0.7;
-            Interpolation = true;
+            Interpolation = InterpolationMode::Linear;
             EarlyStages = 4;
             lpPre.Frequency = 20000;
             lpPost.Frequency = 16000;
             hpPre.Frequency = 20;
             hpPost.Frequency = 20;
+            lpPreR.Frequency = 20000;
+            lpPostR.Frequency = 16000;
+            hpPreR.Frequency = 20;
+            hpPostR.Frequency = 20;
             smoothedFreeze = 0;
             freeze = false;
             ShimmerMode = 0;
+            stereoMode = StereoMode::Mono;
+            tankMode = TankMode::Ring;
+            for (int i = 0; i < 2; i++)
+            {
+                PitchShifters[i] = nullptr;
+                FastPitchShifters[i] = nullptr;
+            }
+            for (int i = 0; i < ShifterCount; i++)
+            {
+                shimmerRunning[i] = false;
+                shimmerGain[i] = 0.0;
+            }
+            shimmerGainDirect = 1.0;
+            memset(Feedback, 0, sizeof(Feedback));
+            FeedbackIndex = 0;
 
             UpdateAll();
         }
 
+        ~Z4RevT()
+        {
+            delete OwnedTank;
+            for (int i = 0; i < 2; i++)
+            {
+                delete PitchShifters[i];
+                delete FastPitchShifters[i];
+            }
+        }
+
+        // Owns the tank and the pitch shifters, a copy would delete them twice
+        Z4RevT(const Z4RevT&) = delete;
+        Z4RevT& operator=(const Z4RevT&) = delete;
+
+        // Control thread only, a new shimmer mode allocates its pitch shifters here
         void SetParameter(int paramId, double value)
         {
+            if (paramId == Parameter::Shimmer)
+                PrepareShimmer((int)value);
+            UpdateDerived(ApplyParameter(paramId, value));
+        }
+
+        // Stores a parameter without recomputing anything, returns the DerivedState groups it affects.
+        // Several parameters applied together then need a single UpdateDerived.
+        // Safe on the audio thread: it never allocates, a shimmer mode that wasn't prepared is ignored
+        int ApplyParameter(int paramId, double value)
+        {
+            int derived = 0;
             if (paramId == Parameter::Decay)
             {
                 if (value < 0.1)
                     value = 0.1;
                 T60 = value;
+                derived = DerivedState::Decay;
             }
             else if (paramId == Parameter::Diffuse)
             {
                 DiffuseFeedback = 0.5 + (1 - value) * 0.49;
+                derived = DerivedState::Late;
             }
             else if (paramId == Parameter::Interpolation)
             {
-                Interpolation = (int)value;
+                Interpolation = (InterpolationMode)(int)value;
+                derived = DerivedState::Early | DerivedState::Late;
             }
             else if (paramId == Parameter::Shimmer)
             {
+                // the audio callback never sees a mode without its engine
+                if (!IsShimmerPrepared((int)value))
+                {
+                    Z4_LOG_WARN("Shimmer mode %d ignored, its pitch shifters weren't prepared", (int)value);
+                    return 0;
+                }
                 ShimmerMode = (int)value;
-                Serial.print("Shimmer mode: ");
-                Serial.println(ShimmerMode);
+                Z4_LOG_INFO("Shimmer mode: %d, latency %d samples", ShimmerMode, GetShimmerLatency());
+            }
+            else if (paramId == Parameter::InputMode)
+            {
+                // Input modes 3 and 4 are Dual Mono and True Stereo, everything else runs the mono engine
+                int mode = (int)value;
+                stereoMode = mode == 3 ? StereoMode::DualMono : mode == 4 ? StereoMode::TrueStereo : StereoMode::Mono;
+                derived = DerivedState::Early; // the early size limit depends on the lanes
             }
             else if (paramId == Parameter::Mix)
             {
@@ -107,15 +257,18 @@ namespace Z4
             else if (paramId == Parameter::SizeEarly)
             {
                 EarlySize = value; // 10-100%
+                derived = DerivedState::Early;
             }
             else if (paramId == Parameter::SizeLate)
             {
                 LateSize = value; // 10-100%
                 DiffuserSize = 0.2 + value * 0.8;
+                derived = DerivedState::Decay | DerivedState::Late;
             }
             else if (paramId == Parameter::Modulate)
             {
                 Modulation = value;
+                derived = DerivedState::Early | DerivedState::Late;
             }
             else if (paramId == Parameter::EarlyStages)
             {
@@ -124,53 +277,113 @@ namespace Z4
             else if (paramId == Parameter::LowCutPre)
             {
                 lpPre.Frequency = value;
+                lpPreR.Frequency = value;
+                derived = DerivedState::LowPassPre;
             }
             else if (paramId == Parameter::LowCutPost)
             {
                 lpPost.Frequency = value;
+                lpPostR.Frequency = value;
+                derived = DerivedState::LowPassPost;
             }
             else if (paramId == Parameter::HighCutPre)
             {
                 hpPre.Frequency = value;
+                hpPreR.Frequency = value;
+                derived = DerivedState::HighPassPre;
             }
             else if (paramId == Parameter::HighCutPost)
             {
                 hpPost.Frequency = value;
+                hpPostR.Frequency = value;
+                derived = DerivedState::HighPassPost;
             }
             else if (paramId == Parameter::Freeze)
             {
 				freeze = value > 0.5;
 			}
 
-            UpdateAll();
+            return derived;
         }
 
         void UpdateAll()
         {
-            lpPre.Update();
-            lpPost.Update();
-            hpPre.Update();
-            hpPost.Update();
+            UpdateDerived(DerivedState::All);
+        }
+
+        void UpdateDerived(int derived)
+        {
+            if (derived & DerivedState::LowPassPre)
+            {
+                lpPre.Update();
+                lpPreR.Update();
+            }
+            if (derived & DerivedState::HighPassPre)
+            {
+                hpPre.Update();
+                hpPreR.Update();
+            }
+            if (derived & DerivedState::LowPassPost)
+            {
+                lpPost.Update();
+                lpPostR.Update();
+            }
+            if (derived & DerivedState::HighPassPost)
+            {
+                hpPost.Update();
+                hpPostR.Update();
+            }
+
+            if ((derived & DerivedState::Decay) && tankMode == TankMode::Fdn)
+            {
+                Krt = std::pow(10, -3 * FdnLoopTime() / T60);
+            }
+            else if (derived & DerivedState::Decay)
+            {
+                const float IdealisedTimeConstant = 0.15 * std::sqrt(LateSize); // assumed tank round trip time
+                auto tcToT60 = T60 / IdealisedTimeConstant;
+                auto dbPerTc = -60 / tcToT60;
+                Krt = std::pow(10, dbPerTc/20);
+            }
 
-            const float IdealisedTimeConstant = 0.15 * std::sqrt(LateSize); // assumed tank round trip time
-            auto tcToT60 = T60 / IdealisedTimeConstant;
-            auto dbPerTc = -60 / tcToT60;
-            Krt = std::pow(10, dbPerTc/20);
+            if (derived & DerivedState::Early)
+                UpdateEarly();
+            if (derived & DerivedState::Late)
+                UpdateLate();
+        }
+
+    private:
+        void UpdateEarly()
+        {
+            // In the stereo modes each pre-diffuser lane only gets half the delay memory.
+            // The knob's range is scaled onto what fits, so its whole travel still does something
+            float earlySize = EarlySize;
+            if (stereoMode != StereoMode::Mono)
+            {
+                float maxSamples = FS_MAX/10/2 - Modulation * 25 - 3;
+                float maxEarlySize = maxSamples / (PreDiffuserSizes[PRE_DIFFUSE_COUNT-1] * 0.001f * Samplerate);
+                if (maxEarlySize < 1)
+                    earlySize *= maxEarlySize;
+            }
 
             for (size_t i = 0; i < PRE_DIFFUSE_COUNT; i++)
             {
                 PreDiffuser[i].Feedback = 0.73;
-                PreDiffuser[i].InterpolationEnabled = Interpolation;
-                PreDiffuser[i].SampleDelay = (int)(PreDiffuserSizes[i] * 0.001 * EarlySize * Samplerate);
+                PreDiffuser[i].Interpolation = Interpolation;
+                PreDiffuser[i].SampleDelay = (int)(PreDiffuserSizes[i] * 0.001 * earlySize * Samplerate);
                 PreDiffuser[i].ModRate = PreDiffuserModRate[i] / Samplerate;
                 PreDiffuser[i].ModAmount = Modulation * 25;
             }
+        }
 
+        void UpdateLate()
+        {
             for (size_t i = 0; i < ZCOUNT; i++)
             {
                 Diffuser[i].Feedback = DiffuseFeedback;
-                Diffuser[i].InterpolationEnabled = Interpolation;
-                Diffuser[i].SampleDelay = (int)(DiffuserSizes[i] * 0.001 * DiffuserSize * Samplerate);
+                Diffuser[i].Interpolation = Interpolation;
+                float diffuserScale = tankMode == TankMode::Fdn ? FdnDiffuserScale : 1;
+                Diffuser[i].SampleDelay = (int)(DiffuserSizes[i] * 0.001 * DiffuserSize * diffuserScale * Samplerate);
                 Diffuser[i].ModRate = DiffuserModRate[i] / Samplerate;
                 Diffuser[i].ModAmount = Modulation * 25;
 
@@ -180,69 +393,278 @@ namespace Z4
             }
         }
 
-        void Process(float** inputs, float** outputs, int bufSize)
+    public:
+        // Call between blocks. Switching rearranges the feedback, so the tail changes character straight away
+        void SetTankMode(TankMode mode)
+        {
+            tankMode = mode;
+            UpdateDerived(DerivedState::Decay | DerivedState::Late);
+        }
+
+        TankMode GetTankMode()
+        {
+            return tankMode;
+        }
+
+        // Allocates the pitch shifters for a shimmer mode ahead of time, for modes that will be set from the audio thread
+        void PrepareShimmer(int mode)
+        {
+            if (mode > 0)
+                AllocateShimmer(mode);
+        }
+
+        bool IsShimmerPrepared(int mode)
+        {
+            if (mode <= 0)
+                return true;
+            if (mode > 5)
+                return FastPitchShifters[0] != nullptr && FastPitchShifters[1] != nullptr;
+            return PitchShifters[0] != nullptr && PitchShifters[1] != nullptr;
+        }
+
+        // Average delay of the pitch shifted path for the selected shimmer mode, 0 when off
+        int GetShimmerLatency()
+        {
+            int latency = 0;
+            for (int k = 0; k < ShifterCount; k++)
+            {
+                if (!IsShifterWanted(k))
+                    continue;
+                int l = k < 2 ? PitchShifters[k]->GetLatency() : FastPitchShifters[k - 2]->GetLatency();
+                if (l > latency)
+                    latency = l;
+            }
+            return latency;
+        }
+
+        // Writes the complete DSP state: settings, smoothing, every line, filter and pitch shifter.
+        // The derived coefficients are recomputed on load rather than stored.
+        void SaveState(StateWriter& writer)
+        {
+            writer.Write(T60);
+            writer.Write(Wet);
+            writer.Write(Dry);
+            writer.Write(EarlySize);
+            writer.Write(DiffuserSize);
+            writer.Write(LateSize);
+            writer.Write(Modulation);
+            writer.Write(DiffuseFeedback);
+            writer.Write(Interpolation);
+            writer.Write(EarlyStages);
+            writer.Write(freeze);
+            writer.Write(smoothedFreeze);
+            writer.Write(ShimmerMode);
+            writer.Write(stereoMode);
+            writer.Write(tankMode);
+            writer.Write(shimmerRunning);
+            writer.Write(shimmerGain);
+            writer.Write(shimmerGainDirect);
+
+            Filter* filters[] = {&lpPre, &lpPost, &hpPre, &hpPost, &lpPreR, &lpPostR, &hpPreR, &hpPostR};
+            for (auto filter : filters)
+                writer.Write(*filter);
+            for (int i = 0; i < PRE_DIFFUSE_COUNT; i++)
+                writer.Write(PreDiffuser[i]);
+            for (int i = 0; i < ZCOUNT * 2; i++)
+                writer.Write(Diffuser[i]);
+            for (int i = 0; i < ZCOUNT; i++)
+                writer.Write(Delay[i]);
+            writer.Write(Feedback);
+            writer.Write(FeedbackIndex);
+
+            // shifters that were never allocated have no state worth keeping
+            for (int i = 0; i < 2; i++)
+            {
+                writer.Write(PitchShifters[i] != nullptr);
+                if (PitchShifters[i] != nullptr)
+                    writer.Write(*PitchShifters[i]);
+                writer.Write(FastPitchShifters[i] != nullptr);
+                if (FastPitchShifters[i] != nullptr)
+                    writer.Write(*FastPitchShifters[i]);
+            }
+        }
+
+        // Counterpart of SaveState. Allocates the pitch shifters the snapshot needs, so it runs on the
+        // control thread, and never concurrently with Process. Returns false when the snapshot is
+        // truncated or a shifter can't be allocated, the engine state is then undefined until the next load.
+        bool LoadState(StateReader& reader)
+        {
+            reader.Read(T60);
+            reader.Read(Wet);
+            reader.Read(Dry);
+            reader.Read(EarlySize);
+            reader.Read(DiffuserSize);
+            reader.Read(LateSize);
+            reader.Read(Modulation);
+            reader.Read(DiffuseFeedback);
+            reader.Read(Interpolation);
+            reader.Read(EarlyStages);
+            reader.Read(freeze);
+            reader.Read(smoothedFreeze);
+            reader.Read(ShimmerMode);
+            reader.Read(stereoMode);
+            reader.Read(tankMode);
+            reader.Read(shimmerRunning);
+            reader.Read(shimmerGain);
+            reader.Read(shimmerGainDirect);
+
+            Filter* filters[] = {&lpPre, &lpPost, &hpPre, &hpPost, &lpPreR, &lpPostR, &hpPreR, &hpPostR};
+            for (auto filter : filters)
+                reader.Read(*filter);
+            for (int i = 0; i < PRE_DIFFUSE_COUNT; i++)
+                reader.Read(PreDiffuser[i]);
+            for (int i = 0; i < ZCOUNT * 2; i++)
+                reader.Read(Diffuser[i]);
+            for (int i = 0; i < ZCOUNT; i++)
+                reader.Read(Delay[i]);
+            reader.Read(Feedback);
+            reader.Read(FeedbackIndex);
+
+            bool ok = reader.IsOk();
+            for (int i = 0; i < 2 && ok; i++)
+            {
+                float pitch = i == 0 ? 2.0 : 0.5;
+                bool present = false;
+                reader.Read(present);
+                // nothrow, see AllocateShimmer. A shifter that can't be allocated fails the load
+                if (present && PitchShifters[i] == nullptr)
+                    PitchShifters[i] = new (std::nothrow) PitchShifter(FS_MAX, pitch);
+                if (present && PitchShifters[i] != nullptr)
+                    reader.Read(*PitchShifters[i]);
+                ok = ok && (!present || PitchShifters[i] != nullptr);
+
+                present = false;
+                reader.Read(present);
+                if (present && FastPitchShifters[i] == nullptr)
+                    FastPitchShifters[i] = new (std::nothrow) FastPitchShifter(pitch);
+                if (present && FastPitchShifters[i] != nullptr)
+                    reader.Read(*FastPitchShifters[i]);
+                ok = ok && (!present || FastPitchShifters[i] != nullptr);
+            }
+
+            UpdateAll();
+            return ok && reader.IsOk();
+        }
+
+        void Process(T** inputs, T** outputs, int bufSize)
         {
             // Jumping straight between 100% feedback (freeze) and the selected feedback causes a click, needs to be smoothed
-			smoothedFreeze = smoothedFreeze * 0.95 + (int)freeze * 0.05;
+            float freezeCoeff = PerBlock(0.95, bufSize);
+			smoothedFreeze = smoothedFreeze * freezeCoeff + (int)freeze * (1 - freezeCoeff);
             float activeKrt = smoothedFreeze + (1-smoothedFreeze) * Krt;
 
-            bool shimmerUp = (ShimmerMode == 1 || ShimmerMode == 3 || ShimmerMode == 5);
-            bool shimmerDown = (ShimmerMode == 2 || ShimmerMode == 4 || ShimmerMode == 5);
-            bool shimmerDirect = (ShimmerMode == 0 || ShimmerMode == 3 || ShimmerMode == 4 || ShimmerMode == 5);
-            float shimmerGain = 1.0 / sqrtf((shimmerUp ? 1 : 0) + (shimmerDown ? 1 : 0) + (shimmerDirect ? 1 : 0));
-
-            auto tb = Buffers::Request();
-            auto tb2 = Buffers::Request();
-            auto tb3 = Buffers::Request();
-            auto buf = tb.Ptr;
-            auto buf2 = tb2.Ptr;
-            auto buf3 = tb3.Ptr;
+            bool stereo = stereoMode != StereoMode::Mono;
+            bool trueStereo = stereoMode == StereoMode::TrueStereo;
 
-            Copy(buf, inputs[0], bufSize);
-            Mix(buf, inputs[1], 1.0, bufSize);
-            lpPre.Process(buf, buf, bufSize);
-            hpPre.Process(buf, buf, bufSize);
+            PoolBuffer tb;
+            PoolBuffer tbR;
+            PoolBuffer tb2;
+            PoolBuffer tb3;
+            auto buf = tb.As<T>();
+            auto bufR = tbR.As<T>();
+            auto buf2 = tb2.As<T>();
 
-            float* preDiffIO = buf;
             for (size_t i = 0; i < PRE_DIFFUSE_COUNT; i++)
+                PreDiffuser[i].SetLanes(stereo ? 2 : 1);
+
+            T* preDiffL;
+            T* preDiffR;
+            if (stereo)
+            {
+                Copy(buf, inputs[0], bufSize);
+                Copy(bufR, inputs[1], bufSize);
+                lpPre.Process(buf, buf, bufSize);
+                hpPre.Process(buf, buf, bufSize);
+                lpPreR.Process(bufR, bufR, bufSize);
+                hpPreR.Process(bufR, bufR, bufSize);
+
+                T* ioL = buf;
+                T* ioR = bufR;
+                for (size_t i = 0; i < PRE_DIFFUSE_COUNT; i++)
+                {
+                    PreDiffuser[i].Process(ioL, ioR, bufSize);
+                    ioL = PreDiffuser[i].GetOutput(0);
+                    ioR = PreDiffuser[i].GetOutput(1);
+                }
+
+                // Each lane carries a single channel rather than the L+R sum, so the 0.5 compensation
+                // used by the mono engine is left out to keep the levels matched
+                preDiffL = PreDiffuser[EarlyStages-1].GetOutput(0);
+                preDiffR = PreDiffuser[EarlyStages-1].GetOutput(1);
+            }
+            else
             {
-                PreDiffuser[i].Process(preDiffIO, bufSize);
-                preDiffIO = PreDiffuser[i].GetOutput();
+                Copy(buf, inputs[0], bufSize);
+                Mix(buf, inputs[1], 1.0, bufSize);
+                lpPre.Process(buf, buf, bufSize);
+                hpPre.Process(buf, buf, bufSize);
+
+                T* preDiffIO = buf;
+                for (size_t i = 0; i < PRE_DIFFUSE_COUNT; i++)
+                {
+                    PreDiffuser[i].Process(preDiffIO, bufSize);
+                    preDiffIO = PreDiffuser[i].GetOutput();
+                }
+
+                preDiffIO = PreDiffuser[EarlyStages-1].GetOutput();
+
+                // this compensates for fact that we take 4 output taps at full volume
+                // It also reduces the max value pushed into the delay line
+                Gain(preDiffIO, 0.5, bufSize);
+                preDiffL = preDiffIO;
+                preDiffR = preDiffIO;
             }
 
-            preDiffIO = PreDiffuser[EarlyStages-1].GetOutput();
+            if (tankMode == TankMode::Fdn)
+                MixLines(bufSize);
+
+            // The head of each tank gets the shimmer and the post filters.
+            // In true stereo line 1 heads the second tank and is prepared up front, alongside line 0
+            Copy(buf, preDiffL, bufSize);
+            MixFeedback(buf, 0, activeKrt, bufSize);
+            if (trueStereo)
+            {
+                Copy(bufR, preDiffR, bufSize);
+                MixFeedback(bufR, 1, activeKrt, bufSize);
+            }
 
-            // this compensates for fact that we take 4 output taps at full volume
-            // It also reduces the max value pushed into the delay line
-            Gain(preDiffIO, 0.5, bufSize); 
+            ProcessShimmer(buf, trueStereo ? bufR : nullptr, tb2.Ptr, tb3.Ptr, bufSize);
+
+            lpPost.Process(buf, buf, bufSize);
+            hpPost.Process(buf, buf, bufSize);
+            if (trueStereo)
+            {
+                lpPostR.Process(bufR, bufR, bufSize);
+                hpPostR.Process(bufR, bufR, bufSize);
+            }
 
             for (size_t i = 0; i < ZCOUNT; i++)
             {
-                Copy(buf, preDiffIO, bufSize);
-                Mix(buf, Delay[(i - 1 + ZCOUNT) % ZCOUNT].GetOutput(), activeKrt, bufSize);
+                T* lineIn = buf2;
                 if (i == 0)
+                    lineIn = buf;
+                else if (i == 1 && trueStereo)
+                    lineIn = bufR;
+                else
+                {
+                    Copy(lineIn, (i % 2) ? preDiffR : preDiffL, bufSize);
+                    MixFeedback(lineIn, i, activeKrt, bufSize);
+                }
+
+                if (tankMode == TankMode::Fdn)
+                {
+                    // the mixing matrix builds up the density, a single diffuser per line is enough
+                    Diffuser[i].Process(lineIn, bufSize);
+                    Delay[i].Process(Diffuser[i].GetOutput(), bufSize);
+                }
+                else
                 {
-                    if (shimmerUp)
-                        PitchShifter2.Process(buf, buf2, bufSize);
-                    if (shimmerDown)
-                        PitchShifter1.Process(buf, buf3, bufSize);
-
-                    if (!shimmerDirect)
-                        ZeroBuffer(buf, bufSize);
-                    if (shimmerUp)
-                        Mix(buf, buf2, 1.0, bufSize);
-                    if (shimmerDown)
-                        Mix(buf, buf3, 1.0, bufSize);
-                    
-                    Gain(buf, shimmerGain, bufSize);
-
-                    lpPost.Process(buf, buf, bufSize);
-                    hpPost.Process(buf, buf, bufSize);
+                    Diffuser[2*i].Process(lineIn, bufSize);
+                    Diffuser[2*i+1].Process(Diffuser[2*i].GetOutput(), bufSize);
+                    Delay[i].Process(Diffuser[2*i+1].GetOutput(), bufSize);
                 }
-                Diffuser[2*i].Process(buf, bufSize);
-                Diffuser[2*i+1].Process(Diffuser[2*i].GetOutput(), bufSize);
-                Delay[i].Process(Diffuser[2*i+1].GetOutput(), bufSize);
             }
+            StoreFeedback(bufSize);
             
             ZeroBuffer(outputs[0], bufSize);
             Mix(outputs[0], Delay[0].GetOutput(), Wet, bufSize);
@@ -254,6 +676,225 @@ namespace Z4
             Mix(outputs[1], Delay[3].GetOutput(), Wet, bufSize);
             Mix(outputs[1], inputs[1], Dry, bufSize);
         }
-        
+
+    private:
+        // The smoothers are tuned per full block. Partial blocks (split by automation) get the
+        // coefficient for their length, so the smoothing time doesn't depend on how a block was split
+        static inline float PerBlock(float coefficient, int bufSize)
+        {
+            return bufSize == BUFFER_SIZE ? coefficient : powf(coefficient, bufSize / (float)BUFFER_SIZE);
+        }
+
+        // Mean time around one line of the FDN in seconds, feedback block included. Every line feeds every
+        // line, so the signal loses the feedback gain once per line rather than once per trip around the tank
+        float FdnLoopTime()
+        {
+            float sum = 0;
+            for (int i = 0; i < ZCOUNT; i++)
+                sum += DelaySizes[i] * LateSize + DiffuserSizes[i] * DiffuserSize * FdnDiffuserScale;
+            return sum * 0.001 / ZCOUNT + BUFFER_SIZE / (float)Samplerate;
+        }
+
+        inline int FeedbackSource(int line)
+        {
+            // In the FDN each line reads its own slot of the feedback, after MixLines() has mixed them
+            if (tankMode == TankMode::Fdn)
+                return line;
+
+            // The mono and dual mono tank is a single ring of all the lines.
+            // True stereo splits it into two rings, 0 <-> 2 and 1 <-> 3
+            if (stereoMode == StereoMode::TrueStereo)
+                return (line + 2) % ZCOUNT;
+            return (line - 1 + ZCOUNT) % ZCOUNT;
+        }
+
+        inline void MixFeedback(T* target, int line, float gain, int bufSize)
+        {
+            // lines fed by an earlier line in the same block take its output directly
+            int source = FeedbackSource(line);
+            if (source < line)
+            {
+                Mix(target, Delay[source].GetOutput(), gain, bufSize);
+                return;
+            }
+
+            int room = BUFFER_SIZE - FeedbackIndex;
+            int first = bufSize < room ? bufSize : room;
+            Mix(target, &Feedback[source][FeedbackIndex], gain, first);
+            if (first < bufSize)
+                Mix(&target[first], Feedback[source], gain, bufSize - first);
+        }
+
+        // Mixes the feedback for the coming block in place, it is overwritten by StoreFeedback() afterwards.
+        // True stereo keeps its two tanks apart and mixes each pair of lines
+        inline void MixLines(int bufSize)
+        {
+            int room = BUFFER_SIZE - FeedbackIndex;
+            int first = bufSize < room ? bufSize : room;
+            MixLines(FeedbackIndex, first);
+            if (first < bufSize)
+                MixLines(0, bufSize - first);
+        }
+
+        inline void MixLines(int offset, int bufSize)
+        {
+            if (stereoMode == StereoMode::TrueStereo)
+            {
+                MixingMatrix::Hadamard2(&Feedback[0][offset], &Feedback[2][offset], bufSize);
+                MixingMatrix::Hadamard2(&Feedback[1][offset], &Feedback[3][offset], bufSize);
+            }
+            else
+            {
+                MixingMatrix::Householder4(&Feedback[0][offset], &Feedback[1][offset], &Feedback[2][offset], &Feedback[3][offset], bufSize);
+            }
+        }
+
+        inline void StoreFeedback(int bufSize)
+        {
+            int room = BUFFER_SIZE - FeedbackIndex;
+            int first = bufSize < room ? bufSize : room;
+            for (int i = 0; i < ZCOUNT; i++)
+            {
+                T* output = Delay[i].GetOutput();
+                Copy(&Feedback[i][FeedbackIndex], output, first);
+                if (first < bufSize)
+                    Copy(Feedback[i], &output[first], bufSize - first);
+            }
+            FeedbackIndex = (FeedbackIndex + bufSize) % BUFFER_SIZE;
+        }
+
+        inline void AllocateShimmer(int mode)
+        {
+            // Runs on the control thread. The Teensy is built without exceptions, so the allocation must be nothrow:
+            // a plain new would run the constructor on a null result. When it fails the mode is ignored, see IsShimmerPrepared
+            bool fast = mode > 5;
+            for (int i = 0; i < 2; i++)
+            {
+                float pitch = i == 0 ? 2.0 : 0.5;
+                if (!fast && PitchShifters[i] == nullptr)
+                {
+                    auto shifter = new (std::nothrow) PitchShifter(FS_MAX, pitch);
+                    if (shifter == nullptr)
+                        Z4_LOG_ERROR("Shimmer: out of memory for the pitch shifter");
+                    PitchShifters[i] = shifter;
+                }
+                if (fast && FastPitchShifters[i] == nullptr)
+                {
+                    auto shifter = new (std::nothrow) FastPitchShifter(pitch);
+                    if (shifter == nullptr)
+                        Z4_LOG_ERROR("Shimmer: out of memory for the pitch shifter");
+                    FastPitchShifters[i] = shifter;
+                }
+            }
+        }
+
+        // Modes 6-10 are the low latency versions of modes 1-5
+        inline bool IsShifterWanted(int slot)
+        {
+            bool fast = ShimmerMode > 5;
+            int mode = fast ? ShimmerMode - 5 : ShimmerMode;
+            if (fast != (slot >= 2))
+                return false;
+            if (slot >= 2 ? FastPitchShifters[slot - 2] == nullptr : PitchShifters[slot] == nullptr)
+                return false;
+            if (slot % 2 == 0)
+                return mode == 1 || mode == 3 || mode == 5;
+            return mode == 2 || mode == 4 || mode == 5;
+        }
+
+        inline void ShifterReset(int slot)
+        {
+            if (slot < 2) PitchShifters[slot]->Reset();
+            else FastPitchShifters[slot - 2]->Reset();
+        }
+
+        inline bool ShifterIsWarm(int slot)
+        {
+            return slot < 2 ? PitchShifters[slot]->IsWarm() : FastPitchShifters[slot - 2]->IsWarm();
+        }
+
+        inline void ShifterProcess(int slot, float* input, float* output, int bufSize)
+        {
+            if (slot < 2) PitchShifters[slot]->Process(input, output, bufSize);
+            else FastPitchShifters[slot - 2]->Process(input, output, bufSize);
+        }
+
+        // lineR is only set in true stereo, both tanks then share the pitch shifters, fed with the sum of the two heads
+        inline void ProcessShimmer(T* line, T* lineR, float* shimmerIn, float* shimmerOut, int bufSize)
+        {
+            int mode = ShimmerMode > 5 ? ShimmerMode - 5 : ShimmerMode;
+            bool shimmerDirect = (mode == 0 || mode == 3 || mode == 4 || mode == 5);
+
+            bool wanted[ShifterCount];
+            bool any = false;
+            for (int k = 0; k < ShifterCount; k++)
+            {
+                wanted[k] = IsShifterWanted(k);
+                any = any || wanted[k] || shimmerRunning[k];
+            }
+
+            if (!any)
+            {
+                shimmerGainDirect = 1.0;
+                return;
+            }
+
+            // A shifter that (re)starts is cleared and warms up before it is heard. Until then the
+            // direct path is kept open, so selecting e.g. "Up" doesn't drop the tank into silence.
+            float target[ShifterCount];
+            float targetSum = 0;
+            for (int k = 0; k < ShifterCount; k++)
+            {
+                if (wanted[k] && !shimmerRunning[k])
+                {
+                    ShifterReset(k);
+                    shimmerRunning[k] = true;
+                }
+                target[k] = wanted[k] && ShifterIsWarm(k) ? 1 : 0;
+                targetSum += target[k];
+            }
+
+            float targetDirect = shimmerDirect || targetSum == 0 ? 1 : 0;
+            float norm = 1.0 / sqrtf(targetSum + targetDirect);
+
+            // crossfade between modes over a few blocks rather than switching gains instantly
+            float fadeCoeff = PerBlock(0.9, bufSize);
+            shimmerGainDirect = shimmerGainDirect * fadeCoeff + targetDirect * norm * (1 - fadeCoeff);
+            for (int k = 0; k < ShifterCount; k++)
+                shimmerGain[k] = shimmerGain[k] * fadeCoeff + target[k] * norm * (1 - fadeCoeff);
+
+            ToFloat(shimmerIn, line, bufSize);
+            if (lineR != nullptr)
+            {
+                ToFloat(shimmerOut, lineR, bufSize);
+                Mix(shimmerIn, shimmerOut, 1.0, bufSize);
+                Gain(shimmerIn, 0.5, bufSize);
+            }
+
+            Gain(line, shimmerGainDirect, bufSize);
+            if (lineR != nullptr)
+                Gain(lineR, shimmerGainDirect, bufSize);
+
+            for (int k = 0; k < ShifterCount; k++)
+            {
+                if (!shimmerRunning[k])
+                    continue;
+
+                ShifterProcess(k, shimmerIn, shimmerOut, bufSize);
+                MixFloat(line, shimmerOut, shimmerGain[k], bufSize);
+                if (lineR != nullptr)
+                    MixFloat(lineR, shimmerOut, shimmerGain[k], bufSize);
+
+                // keep feeding the shifter until it has faded out, then stop spending cycles on it
+                if (!wanted[k] && shimmerGain[k] < 0.001)
+                {
+                    shimmerGain[k] = 0;
+                    shimmerRunning[k] = false;
+                }
+            }
+        }
     };
+
+    typedef Z4RevT<float> Z4Rev;
+    typedef Z4RevT<int32_t> Z4RevFixed;
 }